@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Advise which stat to roll a move with.  Every stat the move allows is
+ * rolled without and, if the momentum of the character is high enough, with
+ * burning momentum whenever it gives a better outcome.  The odds come from
+ * the momentum table built by mkodds.  The options are ranked by the
+ * expected outcome, where a strong hit counts 2, a weak hit 1 and a miss 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "isscrolls.h"
+
+#define ADVISE_STATS	5
+#define ADVISE_OPTIONS	(ADVISE_STATS * 2)
+
+struct advise_move {
+	const char	*name;
+	int		 mask;
+};
+
+struct advise_option {
+	const char		*stat;
+	int			 modifier;
+	int			 burn;
+	const struct odds	*o;
+	double			 expected;
+	double			 upgrade;	/* chance that burning helps */
+};
+
+/* Moves that let the player pick the stat */
+static const struct advise_move advise_moves[] = {
+	{ "battle", STAT_EDGE|STAT_HEART|STAT_IRON|STAT_WITS|STAT_SHADOW },
+	{ "clash", STAT_IRON|STAT_EDGE },
+	{ "compel", STAT_HEART|STAT_IRON|STAT_SHADOW },
+	{ "delvethedepths", STAT_EDGE|STAT_WITS|STAT_SHADOW },
+	{ "enterthefray", STAT_HEART|STAT_WITS|STAT_SHADOW },
+	{ "escapethedepths", STAT_EDGE|STAT_HEART|STAT_IRON|STAT_WITS|STAT_SHADOW },
+	{ "facedanger", STAT_EDGE|STAT_HEART|STAT_IRON|STAT_WITS|STAT_SHADOW },
+	{ "secureanadvantage", STAT_EDGE|STAT_HEART|STAT_IRON|STAT_WITS|STAT_SHADOW },
+	{ "strike", STAT_IRON|STAT_EDGE },
+	{ NULL, 0 }
+};
+
+static const char *advise_stats[ADVISE_STATS] = {
+	"edge", "heart", "iron", "shadow", "wits"
+};
+
+static double
+expected_outcome(const struct odds *o)
+{
+	return (2.0 * o->strong + o->weak) / o->total;
+}
+
+/* Better options first, a roll without burning before the same with it */
+static int
+compare_options(const void *a, const void *b)
+{
+	const struct advise_option *x = a, *y = b;
+
+	if (x->expected != y->expected)
+		return x->expected < y->expected ? 1 : -1;
+	if (x->burn != y->burn)
+		return x->burn - y->burn;
+
+	return strcmp(x->stat, y->stat);
+}
+
+static void
+advise_usage(void)
+{
+	size_t i;
+
+	printf("Please provide a move and optionally a bonus\n\n");
+	printf("> advise <move> [bonus]\n\n");
+	printf("Moves:");
+	for (i = 0; advise_moves[i].name != NULL; i++)
+		printf(" %s", advise_moves[i].name);
+	printf("\n\nExample: advise facedanger 1\n");
+}
+
+void
+cmd_advise(char *cmd)
+{
+	struct character *curchar = get_current_character();
+	const struct advise_move *m;
+	const struct momentum_odds *mo;
+	struct advise_option options[ADVISE_OPTIONS], *op;
+	char move[MAX_STAT_LEN];
+	int bonus = 0, stat, ret, i, n = 0;
+
+	CURCHAR_CHECK();
+
+	ret = get_args_from_cmd(cmd, move, &bonus);
+	if (ret >= 10) {
+		advise_usage();
+		return;
+	} else if (ret <= -20)
+		return;
+
+	for (m = advise_moves; m->name != NULL; m++)
+		if (strcasecmp(m->name, move) == 0)
+			break;
+	if (m->name == NULL) {
+		printf("%s does not let you choose a stat\n\n", move);
+		advise_usage();
+		return;
+	}
+
+	for (i = 0; i < ADVISE_STATS; i++) {
+		if ((stat = return_char_stat(advise_stats[i], m->mask)) == -1)
+			continue;
+		mo = momentum_odds(stat + bonus, curchar->momentum);
+
+		op = &options[n++];
+		op->stat = advise_stats[i];
+		op->modifier = stat + bonus;
+		op->burn = 0;
+		op->o = &mo->roll;
+		op->expected = expected_outcome(op->o);
+		op->upgrade = 0;
+
+		/* Burning is only worth a row if it can change the outcome */
+		if (mo->upgrades == 0)
+			continue;
+		op = &options[n++];
+		op->stat = advise_stats[i];
+		op->modifier = stat + bonus;
+		op->burn = 1;
+		op->o = &mo->burn;
+		op->expected = expected_outcome(op->o);
+		op->upgrade = (double)mo->upgrades / mo->burn.total;
+	}
+	qsort(options, n, sizeof(options[0]), compare_options);
+
+	printf("%s with momentum %d", m->name, curchar->momentum);
+	if (bonus > 0)
+		printf(" and a bonus of +%d", bonus);
+	printf("\n\n");
+	printf("     %-14s %5s %8s %8s %8s %8s %8s\n", "option", "score", "strong",
+		"weak", "miss", "helps", "expected");
+	for (i = 0; i < n; i++) {
+		op = &options[i];
+		printf("%3d. %-6s%-8s %5d %7.2f%% %7.2f%% %7.2f%% ", i + 1,
+			op->stat, op->burn ? " & burn" : "", op->modifier,
+			100.0 * op->o->strong / op->o->total,
+			100.0 * op->o->weak / op->o->total,
+			100.0 * op->o->miss / op->o->total);
+		if (op->burn)
+			printf("%7.2f%% ", 100.0 * op->upgrade);
+		else
+			printf("%8s ", "");
+		if (i == 0)
+			pm(GREEN, "%8.3f\n", op->expected);
+		else
+			printf("%8.3f\n", op->expected);
+	}
+
+	if (curchar->momentum < 0)
+		printf("\nYour negative momentum cancels an action die of %d\n",
+			-curchar->momentum);
+	else if (curchar->momentum > 0)
+		printf("\nBurning cancels challenge dice below %d and resets "
+			"momentum to %d\n", curchar->momentum,
+			curchar->momentum_reset);
+}
+
+/* Iterate over the moves, start with *iter = 0, NULL after the last one */
+const char *
+next_advise_move_name(size_t *iter)
+{
+	if (advise_moves[*iter].name == NULL)
+		return NULL;
+
+	return advise_moves[(*iter)++].name;
+}
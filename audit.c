@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Audit log of all dice.  Every die rolled in rolls.c is appended to
+ * audit.log as a fixed size record in host byte order.  Once the log reaches
+ * AUDIT_MAX_SIZE, it is rotated to audit.log.1 and so on, AUDIT_KEEP old logs
+ * are kept.  The dice of bulk rolls and benchmarks are not logged.
+ *
+ * The statistics of the d6, d10 and d100 are running sums, updated whenever
+ * dice are written, so neither a roll nor the audit command reads the whole
+ * log.  They are saved to audit.stats together with the part of the log they
+ * cover.  If the program ended without saving them, only the rolls after that
+ * part are read again.
+ *
+ * Several sessions can share the log.  The dice of a command are appended in
+ * one write while holding an flock on audit.log.  Before that, a session counts
+ * what the others appended after its own offset, so the statistics of every
+ * session cover the whole log and any of them can be saved.
+ *
+ * The chi-square statistic follows from the sum of the squared counts of all
+ * faces:
+ *
+ * chi2 = sides / n * sum(count^2) - n
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "isscrolls.h"
+
+#define AUDIT_LOG	"audit.log"
+#define AUDIT_STATS	"audit.stats"
+#define AUDIT_MAX_SIZE	(4 * 1024 * 1024)
+#define AUDIT_KEEP	3
+#define AUDIT_MOVE_LEN	16
+#define AUDIT_MAGIC	0x49534155	/* ISAU */
+#define AUDIT_VERSION	1
+#define AUDIT_DICE	3
+#define AUDIT_PENDING	512
+
+struct audit_record {
+	int64_t		time;
+	int32_t		id;		/* character, 0 if none is loaded */
+	uint16_t	sides;
+	uint16_t	value;
+	char		move[AUDIT_MOVE_LEN];
+};
+
+struct audit_dist {
+	uint64_t	n;
+	uint64_t	sum;		/* of all values */
+	uint64_t	sumsq;		/* of all values squared */
+	uint64_t	countsq;	/* of the counts of all faces squared */
+	uint64_t	count[100];
+};
+
+struct audit_stats {
+	uint32_t		magic;
+	uint32_t		version;
+	uint64_t		offset;		/* bytes of audit.log counted */
+	uint64_t		records;
+	uint64_t		other;		/* dice other than d6, d10, d100 */
+	int64_t			first;		/* time of the first roll */
+	struct audit_dist	dist[AUDIT_DICE];
+};
+
+/* Critical chi-square values of the d6, d10 and d100 at 5% and 1% */
+static const struct {
+	uint16_t	sides;
+	double		p5;
+	double		p1;
+} audit_dice[AUDIT_DICE] = {
+	{ 6, 11.070, 15.086 },
+	{ 10, 16.919, 21.666 },
+	{ 100, 123.225, 134.642 },
+};
+
+static struct audit_stats stats;
+static struct audit_record pending[AUDIT_PENDING];
+static size_t npending = 0;
+static int logfd = -1;
+static char move[AUDIT_MOVE_LEN];
+static int loaded = 0, paused = 0, broken = 0;
+
+static void
+audit_path(char *path, size_t len, const char *name, int generation)
+{
+	int ret;
+
+	if (generation == 0)
+		ret = snprintf(path, len, "%s/%s", get_isscrolls_dir(), name);
+	else
+		ret = snprintf(path, len, "%s/%s.%d", get_isscrolls_dir(), name,
+			generation);
+	if (ret < 0 || (size_t)ret >= len) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
+	}
+}
+
+static void
+count_record(const struct audit_record *r)
+{
+	struct audit_dist *d;
+	int i;
+
+	stats.records++;
+	if (stats.first == 0)
+		stats.first = r->time;
+
+	for (i = 0; i < AUDIT_DICE; i++)
+		if (audit_dice[i].sides == r->sides)
+			break;
+	if (i == AUDIT_DICE || r->value < 1 || r->value > r->sides) {
+		stats.other++;
+		return;
+	}
+
+	d = &stats.dist[i];
+	d->n++;
+	d->sum += r->value;
+	d->sumsq += r->value * r->value;
+	d->countsq += 2 * d->count[r->value - 1] + 1;
+	d->count[r->value - 1]++;
+}
+
+/* Called with the log locked, so no other session writes in between */
+static void
+save_stats(void)
+{
+	char path[_POSIX_PATH_MAX], tmp[_POSIX_PATH_MAX];
+	FILE *fp;
+	int ret;
+
+	audit_path(path, sizeof(path), AUDIT_STATS, 0);
+	ret = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if (ret < 0 || (size_t)ret >= sizeof(tmp)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", tmp);
+	}
+
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		log_debug("Cannot open %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+	if (fwrite(&stats, sizeof(stats), 1, fp) != 1) {
+		log_debug("Cannot write %s\n", tmp);
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+
+	if (rename(tmp, path) == -1)
+		log_debug("Cannot rename %s: %s\n", tmp, strerror(errno));
+}
+
+static void
+load_stats(void)
+{
+	char path[_POSIX_PATH_MAX];
+	FILE *fp;
+
+	loaded = 1;
+
+	audit_path(path, sizeof(path), AUDIT_STATS, 0);
+	if ((fp = fopen(path, "rb")) != NULL) {
+		if (fread(&stats, sizeof(stats), 1, fp) != 1 ||
+		    stats.magic != AUDIT_MAGIC || stats.version != AUDIT_VERSION) {
+			log_debug("Ignoring %s\n", path);
+			memset(&stats, 0, sizeof(stats));
+		}
+		fclose(fp);
+	}
+	stats.magic = AUDIT_MAGIC;
+	stats.version = AUDIT_VERSION;
+}
+
+/* Count the records of the open log that were written after stats.offset */
+static void
+count_tail(void)
+{
+	struct audit_record r[AUDIT_PENDING];
+	struct stat sb;
+	uint64_t from = stats.offset;
+	ssize_t len;
+	size_t i;
+
+	if (fstat(logfd, &sb) == -1)
+		return;
+	if ((uint64_t)sb.st_size < stats.offset) {
+		log_debug("%s is shorter than expected\n", AUDIT_LOG);
+		stats.offset = sb.st_size - sb.st_size % sizeof(r[0]);
+		return;
+	}
+
+	while ((len = pread(logfd, r, sizeof(r), stats.offset)) > 0) {
+		for (i = 0; i < len / sizeof(r[0]); i++)
+			count_record(&r[i]);
+		stats.offset += len - len % sizeof(r[0]);
+		if ((size_t)len < sizeof(r))
+			break;
+	}
+
+	if (stats.offset > from)
+		log_debug("Counted the last %llu bytes of %s\n",
+			(unsigned long long)(stats.offset - from), AUDIT_LOG);
+}
+
+/*
+ * Lock audit.log against other sessions and count what they appended.  If
+ * another session rotated the log, the rest of the old one is counted before
+ * the new one is opened.
+ */
+static int
+lock_log(void)
+{
+	char path[_POSIX_PATH_MAX];
+	struct stat sb, fsb;
+
+	if (broken)
+		return -1;
+
+	audit_path(path, sizeof(path), AUDIT_LOG, 0);
+	for (;;) {
+		if (logfd == -1 &&
+		    (logfd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644)) == -1) {
+			log_debug("Cannot open %s: %s\n", path, strerror(errno));
+			broken = 1;
+			return -1;
+		}
+		if (flock(logfd, LOCK_EX) == -1) {
+			log_debug("Cannot lock %s: %s\n", path, strerror(errno));
+			broken = 1;
+			return -1;
+		}
+		if (fstat(logfd, &fsb) == 0 && stat(path, &sb) == 0 &&
+		    sb.st_dev == fsb.st_dev && sb.st_ino == fsb.st_ino)
+			break;
+
+		if (loaded) {
+			count_tail();
+			stats.offset = 0;
+		}
+		close(logfd);
+		logfd = -1;
+	}
+
+	if (!loaded)
+		load_stats();
+	count_tail();
+
+	return 0;
+}
+
+static void
+unlock_log(void)
+{
+	flock(logfd, LOCK_UN);
+}
+
+/* Called with the log locked, the lock goes with the old log */
+static void
+rotate_log(void)
+{
+	char from[_POSIX_PATH_MAX], to[_POSIX_PATH_MAX];
+	int i;
+
+	for (i = AUDIT_KEEP; i > 0; i--) {
+		audit_path(from, sizeof(from), AUDIT_LOG, i - 1);
+		audit_path(to, sizeof(to), AUDIT_LOG, i);
+		if (rename(from, to) == -1 && errno != ENOENT)
+			log_debug("Cannot rename %s: %s\n", from, strerror(errno));
+	}
+
+	stats.offset = 0;
+	save_stats();
+	close(logfd);
+	logfd = -1;
+	log_debug("Rotated %s\n", AUDIT_LOG);
+}
+
+/* Append the pending dice in one write, called with the log locked */
+static void
+append_pending(void)
+{
+	ssize_t len = npending * sizeof(pending[0]);
+	size_t i;
+
+	if (npending == 0)
+		return;
+
+	if (write(logfd, pending, len) != len) {
+		log_debug("Cannot write to %s\n", AUDIT_LOG);
+	} else {
+		for (i = 0; i < npending; i++)
+			count_record(&pending[i]);
+		stats.offset += len;
+	}
+	npending = 0;
+}
+
+/* Queue a die for the audit log, value is 1..sides */
+void
+audit_roll(long sides, long value)
+{
+	struct character *curchar = get_current_character();
+	struct audit_record *r;
+
+	/* Character ids are rolled, too, but they are no dice */
+	if (paused || broken || saving_disabled() || sides > UINT16_MAX)
+		return;
+
+	if (npending == AUDIT_PENDING)
+		flush_audit();
+
+	r = &pending[npending++];
+	memset(r, 0, sizeof(*r));
+	r->time = time(NULL);
+	r->id = curchar != NULL ? curchar->id : 0;
+	r->sides = sides;
+	r->value = value;
+	memcpy(r->move, move, sizeof(r->move));
+}
+
+/* The command that rolls the next dice */
+void
+set_audit_move(const char *name)
+{
+	snprintf(move, sizeof(move), "%s", name);
+}
+
+/* Write the dice of a command to disk, so they survive a crash */
+void
+flush_audit()
+{
+	if (npending == 0 || lock_log() == -1)
+		return;
+
+	append_pending();
+	if (stats.offset >= AUDIT_MAX_SIZE)
+		rotate_log();
+	else
+		unlock_log();
+}
+
+/* Stop logging for a while, e.g. for a benchmark */
+void
+pause_audit(int pause)
+{
+	paused = pause;
+}
+
+void
+close_audit()
+{
+	if ((loaded || npending > 0) && lock_log() == 0) {
+		append_pending();
+		if (stats.offset >= AUDIT_MAX_SIZE)
+			rotate_log();
+		else {
+			save_stats();
+			unlock_log();
+		}
+	}
+	if (logfd != -1) {
+		close(logfd);
+		logfd = -1;
+	}
+}
+
+void
+cmd_audit(__attribute__((unused)) char *unused)
+{
+	const struct audit_dist *d;
+	char date[32];
+	time_t first;
+	double mean, var, chi2, expmean, expvar;
+	int i, sides;
+
+	/* Catch up with the dice of other sessions */
+	if (lock_log() == 0)
+		unlock_log();
+
+	if (stats.records == 0) {
+		printf("No dice rolled yet\n");
+		return;
+	}
+
+	first = stats.first;
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&first));
+	printf("%llu dice rolled since %s\n\n",
+		(unsigned long long)stats.records, date);
+	printf("%-5s %10s %7s %8s %8s %8s %10s %4s\n", "die", "rolls", "mean",
+		"expected", "variance", "expected", "chi-square", "df");
+
+	for (i = 0; i < AUDIT_DICE; i++) {
+		d = &stats.dist[i];
+		sides = audit_dice[i].sides;
+		if (d->n == 0) {
+			printf("d%-4d %10d\n", sides, 0);
+			continue;
+		}
+
+		mean = (double)d->sum / d->n;
+		var = (double)d->sumsq / d->n - mean * mean;
+		expmean = (sides + 1) / 2.0;
+		expvar = (sides * sides - 1) / 12.0;
+		chi2 = (double)sides / d->n * d->countsq - d->n;
+
+		printf("d%-4d %10llu %7.3f %8.3f %8.3f %8.3f %10.2f %4d  ", sides,
+			(unsigned long long)d->n, mean, expmean, var, expvar, chi2,
+			sides - 1);
+		if (d->n < 5ULL * sides)
+			printf("too few rolls\n");
+		else if (chi2 > audit_dice[i].p1)
+			pm(RED, "unfair, p < 1%%\n");
+		else if (chi2 > audit_dice[i].p5)
+			pm(YELLOW, "suspicious, p < 5%%\n");
+		else
+			pm(GREEN, "fair\n");
+	}
+
+	if (stats.other > 0)
+		printf("\n%llu other dice\n", (unsigned long long)stats.other);
+	printf("\nThe log rotates at %d KB, %d old logs are kept\n",
+		AUDIT_MAX_SIZE / 1024, AUDIT_KEEP);
+}
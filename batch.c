@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Fill arrays with dice and classify many action rolls at once.  A batch runs
+ * four xoshiro256** generators side by side, one per 64 bit lane, so a step
+ * of all four fits into one AVX2 or two SSE2 registers.  Every output gives
+ * two dice, one from each half, with Lemire's multiply and reject method.  If
+ * one of the eight dice of a step would be biased, the whole step is dropped,
+ * which keeps all dice uniform and the vector code simple.
+ *
+ * The portable C, the SSE2 and the AVX2 code produce exactly the same dice, so
+ * a seed gives the same results on every machine.  The best code the CPU
+ * supports is picked at runtime.
+ */
+
+#include <sys/param.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define BATCH_X86
+#include <immintrin.h>
+#endif
+
+#include "isscrolls.h"
+
+static const char *impl_names[] = { "portable", "sse2", "avx2" };
+static int impl = -1;
+
+static inline uint64_t
+rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static void
+dice_portable(struct dice_batch *b, uint8_t *out, size_t n, uint32_t sides)
+{
+	uint64_t r[4], m, t0;
+	uint32_t t = -sides % sides;
+	uint8_t tmp[8];
+	size_t k;
+	int l, i, reject;
+
+	while (n > 0) {
+		for (l = 0; l < 4; l++) {
+			r[l] = rotl(b->s[1][l] * 5, 7) * 9;
+			t0 = b->s[1][l] << 17;
+			b->s[2][l] ^= b->s[0][l];
+			b->s[3][l] ^= b->s[1][l];
+			b->s[1][l] ^= b->s[2][l];
+			b->s[0][l] ^= b->s[3][l];
+			b->s[2][l] ^= t0;
+			b->s[3][l] = rotl(b->s[3][l], 45);
+		}
+
+		/* The low half of each output comes first */
+		for (i = 0, reject = 0; i < 8; i++) {
+			m = (uint64_t)(uint32_t)(r[i / 2] >> (32 * (i % 2))) * sides;
+			reject |= (uint32_t)m < t;
+			tmp[i] = (m >> 32) + 1;
+		}
+		if (reject)
+			continue;
+
+		k = MIN(n, 8);
+		memcpy(out, tmp, k);
+		out += k;
+		n -= k;
+	}
+}
+
+static void
+classify_portable(const uint8_t *d6, const uint8_t *c1, const uint8_t *c2,
+	size_t n, int modifier, uint8_t *out, uint64_t counts[3])
+{
+	size_t i;
+	int score;
+
+	for (i = 0; i < n; i++) {
+		score = d6[i] + modifier;
+		if (score > c1[i] && score > c2[i]) {
+			counts[0]++;
+			if (out != NULL)
+				out[i] = 8;
+		} else if (score > c1[i] || score > c2[i]) {
+			counts[1]++;
+			if (out != NULL)
+				out[i] = 4;
+		} else {
+			counts[2]++;
+			if (out != NULL)
+				out[i] = 2;
+		}
+	}
+}
+
+#ifdef BATCH_X86
+/* One step of two of the generators, returns their outputs */
+static inline __m128i
+next_sse2(__m128i *s0, __m128i *s1, __m128i *s2, __m128i *s3)
+{
+	__m128i r, t;
+
+	r = _mm_add_epi64(_mm_slli_epi64(*s1, 2), *s1);
+	r = _mm_or_si128(_mm_slli_epi64(r, 7), _mm_srli_epi64(r, 57));
+	r = _mm_add_epi64(_mm_slli_epi64(r, 3), r);
+
+	t = _mm_slli_epi64(*s1, 17);
+	*s2 = _mm_xor_si128(*s2, *s0);
+	*s3 = _mm_xor_si128(*s3, *s1);
+	*s1 = _mm_xor_si128(*s1, *s2);
+	*s0 = _mm_xor_si128(*s0, *s3);
+	*s2 = _mm_xor_si128(*s2, t);
+	*s3 = _mm_or_si128(_mm_slli_epi64(*s3, 45), _mm_srli_epi64(*s3, 19));
+
+	return r;
+}
+
+/* Four dice of two outputs as 32 bit values, *reject is set on bias */
+static inline __m128i
+dice_sse2(__m128i r, __m128i vn, __m128i vt, __m128i *reject)
+{
+	const __m128i bias = _mm_set1_epi32((int)0x80000000);
+	const __m128i low = _mm_set_epi32(0, -1, 0, -1);
+	__m128i mlo, mhi, frac;
+
+	mlo = _mm_mul_epu32(r, vn);
+	mhi = _mm_mul_epu32(_mm_srli_epi64(r, 32), vn);
+
+	frac = _mm_or_si128(_mm_and_si128(mlo, low), _mm_slli_epi64(mhi, 32));
+	*reject = _mm_or_si128(*reject,
+		_mm_cmpgt_epi32(vt, _mm_xor_si128(frac, bias)));
+
+	return _mm_or_si128(_mm_srli_epi64(mlo, 32), _mm_andnot_si128(low, mhi));
+}
+
+static void
+dice_sse2_fill(struct dice_batch *b, uint8_t *out, size_t n, uint32_t sides)
+{
+	__m128i s0a, s1a, s2a, s3a, s0b, s1b, s2b, s3b;
+	__m128i vn, vt, one, da, db, d, reject;
+	uint8_t tmp[16];
+
+	s0a = _mm_loadu_si128((const __m128i *)&b->s[0][0]);
+	s0b = _mm_loadu_si128((const __m128i *)&b->s[0][2]);
+	s1a = _mm_loadu_si128((const __m128i *)&b->s[1][0]);
+	s1b = _mm_loadu_si128((const __m128i *)&b->s[1][2]);
+	s2a = _mm_loadu_si128((const __m128i *)&b->s[2][0]);
+	s2b = _mm_loadu_si128((const __m128i *)&b->s[2][2]);
+	s3a = _mm_loadu_si128((const __m128i *)&b->s[3][0]);
+	s3b = _mm_loadu_si128((const __m128i *)&b->s[3][2]);
+
+	vn = _mm_set1_epi32((int)sides);
+	vt = _mm_set1_epi32((int)((-sides % sides) ^ 0x80000000));
+	one = _mm_set1_epi8(1);
+
+	while (n > 0) {
+		reject = _mm_setzero_si128();
+		da = dice_sse2(next_sse2(&s0a, &s1a, &s2a, &s3a), vn, vt,
+			&reject);
+		db = dice_sse2(next_sse2(&s0b, &s1b, &s2b, &s3b), vn, vt,
+			&reject);
+		if (_mm_movemask_epi8(reject))
+			continue;
+
+		d = _mm_packs_epi32(da, db);
+		d = _mm_add_epi8(_mm_packus_epi16(d, d), one);
+		if (n >= 8) {
+			_mm_storel_epi64((__m128i *)out, d);
+			out += 8;
+			n -= 8;
+		} else {
+			_mm_storeu_si128((__m128i *)tmp, d);
+			memcpy(out, tmp, n);
+			n = 0;
+		}
+	}
+
+	_mm_storeu_si128((__m128i *)&b->s[0][0], s0a);
+	_mm_storeu_si128((__m128i *)&b->s[0][2], s0b);
+	_mm_storeu_si128((__m128i *)&b->s[1][0], s1a);
+	_mm_storeu_si128((__m128i *)&b->s[1][2], s1b);
+	_mm_storeu_si128((__m128i *)&b->s[2][0], s2a);
+	_mm_storeu_si128((__m128i *)&b->s[2][2], s2b);
+	_mm_storeu_si128((__m128i *)&b->s[3][0], s3a);
+	_mm_storeu_si128((__m128i *)&b->s[3][2], s3b);
+}
+
+static void
+classify_sse2(const uint8_t *d6, const uint8_t *c1, const uint8_t *c2,
+	size_t n, int modifier, uint8_t *out, uint64_t counts[3])
+{
+	const __m128i vmod = _mm_set1_epi8((char)modifier);
+	const __m128i v8 = _mm_set1_epi8(8), v4 = _mm_set1_epi8(4);
+	const __m128i v2 = _mm_set1_epi8(2);
+	__m128i score, gt1, gt2, strong, hit;
+	uint64_t strongs = 0, misses = 0;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		score = _mm_adds_epu8(_mm_loadu_si128((const __m128i *)&d6[i]),
+			vmod);
+		gt1 = _mm_cmpgt_epi8(score,
+			_mm_loadu_si128((const __m128i *)&c1[i]));
+		gt2 = _mm_cmpgt_epi8(score,
+			_mm_loadu_si128((const __m128i *)&c2[i]));
+		strong = _mm_and_si128(gt1, gt2);
+		hit = _mm_or_si128(gt1, gt2);
+
+		strongs += __builtin_popcount(_mm_movemask_epi8(strong));
+		misses += 16 - __builtin_popcount(_mm_movemask_epi8(hit));
+		if (out != NULL)
+			_mm_storeu_si128((__m128i *)&out[i],
+			    _mm_or_si128(_mm_and_si128(strong, v8),
+			    _mm_andnot_si128(strong, _mm_or_si128(
+			    _mm_and_si128(hit, v4), _mm_andnot_si128(hit, v2)))));
+	}
+	counts[0] += strongs;
+	counts[1] += i - strongs - misses;
+	counts[2] += misses;
+
+	classify_portable(&d6[i], &c1[i], &c2[i], n - i, modifier,
+		out != NULL ? &out[i] : NULL, counts);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+next_avx2(__m256i *s0, __m256i *s1, __m256i *s2, __m256i *s3)
+{
+	__m256i r, t;
+
+	r = _mm256_add_epi64(_mm256_slli_epi64(*s1, 2), *s1);
+	r = _mm256_or_si256(_mm256_slli_epi64(r, 7), _mm256_srli_epi64(r, 57));
+	r = _mm256_add_epi64(_mm256_slli_epi64(r, 3), r);
+
+	t = _mm256_slli_epi64(*s1, 17);
+	*s2 = _mm256_xor_si256(*s2, *s0);
+	*s3 = _mm256_xor_si256(*s3, *s1);
+	*s1 = _mm256_xor_si256(*s1, *s2);
+	*s0 = _mm256_xor_si256(*s0, *s3);
+	*s2 = _mm256_xor_si256(*s2, t);
+	*s3 = _mm256_or_si256(_mm256_slli_epi64(*s3, 45),
+		_mm256_srli_epi64(*s3, 19));
+
+	return r;
+}
+
+__attribute__((target("avx2")))
+static void
+dice_avx2_fill(struct dice_batch *b, uint8_t *out, size_t n, uint32_t sides)
+{
+	const __m256i bias = _mm256_set1_epi32((int)0x80000000);
+	const __m256i low = _mm256_set1_epi64x(0xffffffffLL);
+	__m256i s0, s1, s2, s3, r, vn, vt, mlo, mhi, frac, d;
+	__m128i d8, one;
+	uint8_t tmp[16];
+
+	s0 = _mm256_loadu_si256((const __m256i *)b->s[0]);
+	s1 = _mm256_loadu_si256((const __m256i *)b->s[1]);
+	s2 = _mm256_loadu_si256((const __m256i *)b->s[2]);
+	s3 = _mm256_loadu_si256((const __m256i *)b->s[3]);
+
+	vn = _mm256_set1_epi32((int)sides);
+	vt = _mm256_set1_epi32((int)((-sides % sides) ^ 0x80000000));
+	one = _mm_set1_epi8(1);
+
+	while (n > 0) {
+		r = next_avx2(&s0, &s1, &s2, &s3);
+		mlo = _mm256_mul_epu32(r, vn);
+		mhi = _mm256_mul_epu32(_mm256_srli_epi64(r, 32), vn);
+
+		frac = _mm256_or_si256(_mm256_and_si256(mlo, low),
+			_mm256_slli_epi64(mhi, 32));
+		if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(vt,
+		    _mm256_xor_si256(frac, bias))))
+			continue;
+
+		/* Eight dice as 32 bit values, packed per 128 bit half */
+		d = _mm256_or_si256(_mm256_srli_epi64(mlo, 32),
+			_mm256_andnot_si256(low, mhi));
+		d = _mm256_packs_epi32(d, d);
+		d = _mm256_packus_epi16(d, d);
+		d8 = _mm_unpacklo_epi32(_mm256_castsi256_si128(d),
+			_mm256_extracti128_si256(d, 1));
+		d8 = _mm_add_epi8(d8, one);
+		if (n >= 8) {
+			_mm_storel_epi64((__m128i *)out, d8);
+			out += 8;
+			n -= 8;
+		} else {
+			_mm_storeu_si128((__m128i *)tmp, d8);
+			memcpy(out, tmp, n);
+			n = 0;
+		}
+	}
+
+	_mm256_storeu_si256((__m256i *)b->s[0], s0);
+	_mm256_storeu_si256((__m256i *)b->s[1], s1);
+	_mm256_storeu_si256((__m256i *)b->s[2], s2);
+	_mm256_storeu_si256((__m256i *)b->s[3], s3);
+}
+
+__attribute__((target("avx2")))
+static void
+classify_avx2(const uint8_t *d6, const uint8_t *c1, const uint8_t *c2,
+	size_t n, int modifier, uint8_t *out, uint64_t counts[3])
+{
+	const __m256i vmod = _mm256_set1_epi8((char)modifier);
+	const __m256i v8 = _mm256_set1_epi8(8), v4 = _mm256_set1_epi8(4);
+	const __m256i v2 = _mm256_set1_epi8(2);
+	__m256i score, gt1, gt2, strong, hit;
+	uint64_t strongs = 0, misses = 0;
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		score = _mm256_adds_epu8(
+			_mm256_loadu_si256((const __m256i *)&d6[i]), vmod);
+		gt1 = _mm256_cmpgt_epi8(score,
+			_mm256_loadu_si256((const __m256i *)&c1[i]));
+		gt2 = _mm256_cmpgt_epi8(score,
+			_mm256_loadu_si256((const __m256i *)&c2[i]));
+		strong = _mm256_and_si256(gt1, gt2);
+		hit = _mm256_or_si256(gt1, gt2);
+
+		strongs += __builtin_popcount(
+			(uint32_t)_mm256_movemask_epi8(strong));
+		misses += 32 - __builtin_popcount(
+			(uint32_t)_mm256_movemask_epi8(hit));
+		if (out != NULL)
+			_mm256_storeu_si256((__m256i *)&out[i],
+			    _mm256_or_si256(_mm256_and_si256(strong, v8),
+			    _mm256_andnot_si256(strong, _mm256_or_si256(
+			    _mm256_and_si256(hit, v4),
+			    _mm256_andnot_si256(hit, v2)))));
+	}
+	counts[0] += strongs;
+	counts[1] += i - strongs - misses;
+	counts[2] += misses;
+
+	classify_portable(&d6[i], &c1[i], &c2[i], n - i, modifier,
+		out != NULL ? &out[i] : NULL, counts);
+}
+#endif /* BATCH_X86 */
+
+const char *
+batch_impl_name(enum batch_impl which)
+{
+	return impl_names[which];
+}
+
+/* Use the given code for all batches, -1 if the CPU does not support it */
+int
+batch_set_impl(enum batch_impl which)
+{
+	switch (which) {
+	case BATCH_PORTABLE:
+		break;
+	case BATCH_SSE2:
+#ifdef BATCH_X86
+		break;
+#else
+		return -1;
+#endif
+	case BATCH_AVX2:
+#ifdef BATCH_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			break;
+#endif
+		return -1;
+	}
+
+	impl = which;
+	log_debug("Batched dice use the %s code\n", impl_names[impl]);
+
+	return 0;
+}
+
+enum batch_impl
+batch_get_impl()
+{
+	if (impl == -1 && batch_set_impl(BATCH_AVX2) == -1 &&
+	    batch_set_impl(BATCH_SSE2) == -1)
+		batch_set_impl(BATCH_PORTABLE);
+
+	return impl;
+}
+
+/* Seed the four generators of a batch from r */
+void
+batch_seed(struct dice_batch *b, struct dice_rng *r)
+{
+	struct dice_rng lane;
+	int l, w;
+
+	for (l = 0; l < 4; l++) {
+		rng_seed(&lane, rng_next(r));
+		for (w = 0; w < 4; w++)
+			b->s[w][l] = lane.s[w];
+	}
+}
+
+/* Fill out with n dice from 1 to sides, sides must be between 1 and 255 */
+void
+batch_dice(struct dice_batch *b, uint8_t *out, size_t n, uint32_t sides)
+{
+	if (sides < 1 || sides > UINT8_MAX)
+		log_errx(1, "Cannot roll a batch of d%u\n", sides);
+
+	switch (batch_get_impl()) {
+	case BATCH_AVX2:
+#ifdef BATCH_X86
+		dice_avx2_fill(b, out, n, sides);
+		break;
+#endif
+	case BATCH_SSE2:
+#ifdef BATCH_X86
+		dice_sse2_fill(b, out, n, sides);
+		break;
+#endif
+	case BATCH_PORTABLE:
+		dice_portable(b, out, n, sides);
+		break;
+	}
+}
+
+/*
+ * Classify n action rolls with an action die, two challenge dice from 1 to 10
+ * and the modifier like action_roll() does.  The outcomes are stored as 8, 4
+ * or 2 in out, if it is not NULL, and added to counts as strong hits, weak
+ * hits and misses.
+ */
+void
+batch_classify(const uint8_t *d6, const uint8_t *c1, const uint8_t *c2,
+	size_t n, int modifier, uint8_t *out, uint64_t counts[3])
+{
+	modifier = MAX(0, MIN(modifier, ODDS_MAX_MODIFIER));
+
+	switch (batch_get_impl()) {
+	case BATCH_AVX2:
+#ifdef BATCH_X86
+		classify_avx2(d6, c1, c2, n, modifier, out, counts);
+		break;
+#endif
+	case BATCH_SSE2:
+#ifdef BATCH_X86
+		classify_sse2(d6, c1, c2, n, modifier, out, counts);
+		break;
+#endif
+	case BATCH_PORTABLE:
+		classify_portable(d6, c1, c2, n, modifier, out, counts);
+		break;
+	}
+}
@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Benchmarks of the hot paths.  They roll with generators of their own, so
+ * the dice of the session and of the current character stay untouched, and
+ * their dice are not written to the audit log.
+ *
+ * The startup benchmark runs the program again and again on a copy of the
+ * characters in a scratch directory, which is removed afterwards.  On OpenBSD
+ * the sandbox forbids exec, so it is not built there.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "isscrolls.h"
+
+#define BENCH_CHUNK	4096
+#define BENCH_MILLIONS	10
+#define BENCH_ENTROPY	1		/* millions, a die may cost a syscall */
+#define BENCH_MODIFIER	2
+#define BENCH_SEED	0x15c2011
+#define BENCH_NCHUNKS	4
+#define BENCH_RUNS	20
+#define BENCH_NSTARTS	4
+
+#ifndef __OpenBSD__
+struct bench_start {
+	const char	*name;
+	char		*args[4];
+	const char	*input;		/* written to stdin */
+};
+
+/* From the full interactive startup to commands that need no character */
+static const struct bench_start starts[BENCH_NSTARTS] = {
+	{ "readline", { "-b", NULL }, "challenge\nquit\n" },
+	{ "-f -", { "-f", "-", NULL }, "challenge\n" },
+	{ "-e print", { "-e", "print", NULL }, "" },
+	{ "-e challenge", { "-e", "challenge", NULL }, "" },
+};
+
+/* Files copied into the scratch directory */
+static const char *start_files[] = {
+	"characters.json", "journey.json", "fight.json", "delve.json", "history",
+	NULL
+};
+#endif /* !__OpenBSD__ */
+
+static double
+elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+print_row(const char *name, uint64_t n, double secs, double scalar,
+	const uint64_t counts[3])
+{
+	printf("%-11s %12.0f %7.2fx %7.3f%% %7.3f%% %7.3f%%\n", name, n / secs,
+		scalar / secs, 100.0 * counts[0] / n, 100.0 * counts[1] / n,
+		100.0 * counts[2] / n);
+}
+
+/*
+ * Action rolls one die at a time like action_roll(), from the kernel if that
+ * is the source of the dice
+ */
+static double
+bench_scalar(uint64_t n, uint64_t counts[3])
+{
+	struct dice_rng rng, *prev = get_dice_rng();
+	struct timespec start;
+	uint64_t i;
+	long score, c1, c2;
+
+	rng_seed(&rng, BENCH_SEED);
+	set_dice_rng(&rng);
+	pause_audit(1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		score = roll_action_die() + BENCH_MODIFIER;
+		c1 = roll_challenge_die();
+		c2 = roll_challenge_die();
+		c1 = (c1 == 0 ? 10 : c1);
+		c2 = (c2 == 0 ? 10 : c2);
+		if (score > c1 && score > c2)
+			counts[0]++;
+		else if (score > c1 || score > c2)
+			counts[1]++;
+		else
+			counts[2]++;
+	}
+
+	pause_audit(0);
+	set_dice_rng(prev);
+
+	return elapsed(&start);
+}
+
+static double
+bench_batch(uint64_t n, uint64_t counts[3])
+{
+	static uint8_t d6[BENCH_CHUNK], c1[BENCH_CHUNK], c2[BENCH_CHUNK];
+	static uint8_t out[BENCH_CHUNK];
+	struct dice_batch b;
+	struct dice_rng rng;
+	struct timespec start;
+	uint64_t done;
+	size_t k;
+
+	rng_seed(&rng, BENCH_SEED);
+	batch_seed(&b, &rng);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (done = 0; done < n; done += k) {
+		k = MIN(n - done, BENCH_CHUNK);
+		batch_dice(&b, d6, k, 6);
+		batch_dice(&b, c1, k, 10);
+		batch_dice(&b, c2, k, 10);
+		batch_classify(d6, c1, c2, k, BENCH_MODIFIER, out, counts);
+	}
+
+	return elapsed(&start);
+}
+
+static void
+bench_dice(long millions)
+{
+	const struct odds *o = action_odds(BENCH_MODIFIER);
+	uint64_t n = millions * 1000000ULL;
+	uint64_t counts[3], first[3];
+	enum batch_impl saved = batch_get_impl();
+	double scalar, secs;
+	int which, same = 1, tested = 0;
+
+	printf("%llu action rolls with +%d, three dice each\n\n",
+		(unsigned long long)n, BENCH_MODIFIER);
+	printf("%-11s %12s %8s %8s %8s %8s\n", "code", "rolls/s", "speedup",
+		"strong", "weak", "miss");
+
+	memset(counts, 0, sizeof(counts));
+	scalar = bench_scalar(n, counts);
+	print_row("scalar", n, scalar, scalar, counts);
+
+	for (which = BATCH_PORTABLE; which <= BATCH_AVX2; which++) {
+		if (batch_set_impl(which) == -1) {
+			printf("%-11s not supported by this CPU\n",
+				batch_impl_name(which));
+			continue;
+		}
+		memset(counts, 0, sizeof(counts));
+		secs = bench_batch(n, counts);
+		print_row(batch_impl_name(which), n, secs, scalar, counts);
+
+		/* The same seed has to give the same dice with every code */
+		if (tested++ == 0)
+			memcpy(first, counts, sizeof(first));
+		else if (memcmp(first, counts, sizeof(first)) != 0)
+			same = 0;
+	}
+	batch_set_impl(saved);
+
+	printf("%-11s %12s %8s %7.3f%% %7.3f%% %7.3f%%\n", "exact", "", "",
+		100.0 * o->strong / o->total, 100.0 * o->weak / o->total,
+		100.0 * o->miss / o->total);
+	if (!same)
+		pm(RED, "The batch codes rolled different dice\n");
+	printf("Batches use the %s code\n", batch_impl_name(saved));
+}
+
+/* The generators against dice from the kernel, read in chunks of any size */
+static void
+bench_entropy(long millions)
+{
+	static const size_t chunks[BENCH_NCHUNKS] = { 4, 64, 256, 4096 };
+	const struct odds *o = action_odds(BENCH_MODIFIER);
+	enum dice_source saved = get_dice_source();
+	uint64_t n = millions * 1000000ULL;
+	uint64_t counts[3];
+	char name[16];
+	double prng, secs;
+	size_t i;
+
+	printf("%llu action rolls with +%d, three dice each\n\n",
+		(unsigned long long)n, BENCH_MODIFIER);
+	printf("%-11s %12s %8s %8s %8s %8s\n", "source", "rolls/s", "speedup",
+		"strong", "weak", "miss");
+
+	set_dice_source(DICE_PRNG);
+	memset(counts, 0, sizeof(counts));
+	prng = bench_scalar(n, counts);
+	print_row("prng", n, prng, prng, counts);
+
+	/* A chunk of four bytes is one syscall per die */
+	set_dice_source(DICE_ENTROPY);
+	for (i = 0; i < BENCH_NCHUNKS; i++) {
+		set_entropy_chunk(chunks[i]);
+		memset(counts, 0, sizeof(counts));
+		secs = bench_scalar(n, counts);
+		snprintf(name, sizeof(name), "kernel/%zu", chunks[i]);
+		print_row(name, n, secs, prng, counts);
+	}
+	set_entropy_chunk(chunks[BENCH_NCHUNKS - 1]);
+	set_dice_source(saved);
+
+	printf("%-11s %12s %8s %7.3f%% %7.3f%% %7.3f%%\n", "exact", "", "",
+		100.0 * o->strong / o->total, 100.0 * o->weak / o->total,
+		100.0 * o->miss / o->total);
+	printf("kernel/N reads N bytes at once, the dice use %s\n",
+		saved == DICE_ENTROPY ? "the kernel" : "the generators");
+}
+
+#ifndef __OpenBSD__
+static void
+copy_file(const char *name, const char *to)
+{
+	char src[_POSIX_PATH_MAX], dst[_POSIX_PATH_MAX], buf[BENCH_CHUNK];
+	ssize_t n;
+	int in, out, ret;
+
+	ret = snprintf(src, sizeof(src), "%s/%s", get_isscrolls_dir(), name);
+	if (ret < 0 || (size_t)ret >= sizeof(src)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", src);
+	}
+	ret = snprintf(dst, sizeof(dst), "%s/%s", to, name);
+	if (ret < 0 || (size_t)ret >= sizeof(dst)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", dst);
+	}
+
+	if ((in = open(src, O_RDONLY)) == -1)
+		return;
+	if ((out = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0600)) == -1) {
+		log_debug("Cannot open %s: %s\n", dst, strerror(errno));
+		close(in);
+		return;
+	}
+	while ((n = read(in, buf, sizeof(buf))) > 0)
+		if (write(out, buf, n) != n)
+			break;
+	close(in);
+	close(out);
+}
+
+/* Remove a directory and the files in it */
+static void
+remove_dir(const char *path)
+{
+	char file[_POSIX_PATH_MAX];
+	struct dirent *dp;
+	DIR *dirp;
+	int ret;
+
+	if ((dirp = opendir(path)) != NULL) {
+		while ((dp = readdir(dirp)) != NULL) {
+			if (strcmp(dp->d_name, ".") == 0 ||
+			    strcmp(dp->d_name, "..") == 0)
+				continue;
+			ret = snprintf(file, sizeof(file), "%s/%s", path,
+				dp->d_name);
+			if (ret < 0 || (size_t)ret >= sizeof(file))
+				continue;
+			if (unlink(file) == -1)
+				log_debug("Cannot remove %s: %s\n", file,
+					strerror(errno));
+		}
+		closedir(dirp);
+	}
+	if (rmdir(path) == -1)
+		log_debug("Cannot remove %s: %s\n", path, strerror(errno));
+}
+
+/* Run the program once with its config in scratch, -1 if it failed */
+static double
+run_start(const struct bench_start *b, const char *scratch)
+{
+	char *argv[6];
+	struct timespec start;
+	size_t len = strlen(b->input);
+	pid_t pid;
+	int fds[2], null, status, i;
+
+	argv[0] = get_program_path();
+	for (i = 0; b->args[i] != NULL; i++)
+		argv[i + 1] = b->args[i];
+	argv[i + 1] = NULL;
+
+	if (pipe(fds) == -1)
+		log_errx(1, "pipe");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	switch ((pid = fork())) {
+	case -1:
+		log_errx(1, "fork");
+		break;
+	case 0:
+		close(fds[1]);
+		if ((null = open("/dev/null", O_WRONLY)) == -1 ||
+		    dup2(fds[0], STDIN_FILENO) == -1 ||
+		    dup2(null, STDOUT_FILENO) == -1 ||
+		    dup2(null, STDERR_FILENO) == -1)
+			_exit(127);
+		setenv("XDG_CONFIG_HOME", scratch, 1);
+#ifdef __linux__
+		execv("/proc/self/exe", argv);
+#endif
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	/* The input is far smaller than a pipe buffer */
+	close(fds[0]);
+	if (len > 0 && write(fds[1], b->input, len) != (ssize_t)len)
+		log_debug("Cannot write the input of %s\n", b->name);
+	close(fds[1]);
+
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0)
+		return -1;
+
+	return elapsed(&start);
+}
+
+/* Time from the start to the exit of the program, per invocation */
+static void
+bench_startup(const char *arg)
+{
+	char scratch[_POSIX_PATH_MAX], dir[_POSIX_PATH_MAX];
+	const char **f;
+	char *ep;
+	double secs, sum, best, full = 0;
+	long r, runs = BENCH_RUNS;
+	int i, ret;
+
+	if (arg != NULL) {
+		errno = 0;
+		runs = strtol(arg, &ep, 10);
+		if (*ep != '\0' || errno == ERANGE || runs < 1 || runs > 10000) {
+			printf("Please provide between 1 and 10000 runs\n");
+			return;
+		}
+	}
+
+	ret = snprintf(scratch, sizeof(scratch), "%s/startup.XXXXXX",
+		get_isscrolls_dir());
+	if (ret < 0 || (size_t)ret >= sizeof(scratch)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", scratch);
+	}
+	if (mkdtemp(scratch) == NULL) {
+		printf("Cannot create %s: %s\n", scratch, strerror(errno));
+		return;
+	}
+	ret = snprintf(dir, sizeof(dir), "%s/isscrolls", scratch);
+	if (ret < 0 || (size_t)ret >= sizeof(dir)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", dir);
+	}
+	if (mkdir(dir, 0700) == -1) {
+		printf("Cannot create %s: %s\n", dir, strerror(errno));
+		rmdir(scratch);
+		return;
+	}
+
+	printf("%ld runs of each startup, on a copy of the characters\n\n", runs);
+	printf("%-13s %10s %10s %8s\n", "startup", "ms/run", "best ms", "speedup");
+
+	for (i = 0; i < BENCH_NSTARTS; i++) {
+		/* Every run starts from the same files */
+		for (r = 0, sum = 0, best = 0; r < runs; r++) {
+			remove_dir(dir);
+			if (mkdir(dir, 0700) == -1)
+				log_errx(1, "Cannot create %s\n", dir);
+			for (f = start_files; *f != NULL; f++)
+				copy_file(*f, dir);
+
+			if ((secs = run_start(&starts[i], scratch)) < 0)
+				break;
+			sum += secs;
+			if (r == 0 || secs < best)
+				best = secs;
+		}
+		if (r < runs) {
+			printf("%-13s failed to run %s\n", starts[i].name,
+				get_program_path());
+			continue;
+		}
+		if (i == 0)
+			full = sum;
+		printf("%-13s %10.2f %10.2f ", starts[i].name, 1000 * sum / runs,
+			1000 * best);
+		if (full > 0)
+			printf("%7.2fx\n", full / sum);
+		else
+			printf("%8s\n", "");
+	}
+
+	remove_dir(dir);
+	rmdir(scratch);
+}
+#endif /* !__OpenBSD__ */
+
+static void
+bench_usage(void)
+{
+	printf("Please provide what to benchmark\n\n");
+	printf("> benchmark dice [millions]\t- Scalar against batched dice\n");
+	printf("> benchmark entropy [millions]\t- Generators against kernel dice\n");
+#ifndef __OpenBSD__
+	printf("> benchmark startup [runs]\t- Time from start to exit of isscrolls\n");
+#endif
+}
+
+void
+cmd_benchmark(char *cmd)
+{
+	char *tokens[3] = { NULL };
+	char *p, *last, *ep;
+	long millions;
+	int i = 0, entropy;
+
+	for ((p = strtok_r(cmd, " ", &last)); p;
+	    (p = strtok_r(NULL, " ", &last))) {
+		if (i < 2)
+			tokens[i++] = p;
+	}
+
+	if (tokens[0] != NULL && strcasecmp(tokens[0], "startup") == 0) {
+#ifdef __OpenBSD__
+		printf("The startup benchmark is not available on OpenBSD, the "
+		    "sandbox does not allow to run programs\n");
+#else
+		bench_startup(tokens[1]);
+#endif /* __OpenBSD__ */
+		return;
+	}
+
+	if (tokens[0] == NULL || (strcasecmp(tokens[0], "dice") != 0 &&
+	    strcasecmp(tokens[0], "entropy") != 0)) {
+		bench_usage();
+		return;
+	}
+	entropy = strcasecmp(tokens[0], "entropy") == 0;
+	millions = entropy ? BENCH_ENTROPY : BENCH_MILLIONS;
+
+	if (tokens[1] != NULL) {
+		errno = 0;
+		millions = strtol(tokens[1], &ep, 10);
+		if (*ep != '\0' || errno == ERANGE || millions < 1 ||
+		    millions > 10000) {
+			printf("Please provide between 1 and 10000 million rolls\n");
+			return;
+		}
+	}
+
+	if (entropy)
+		bench_entropy(millions);
+	else
+		bench_dice(millions);
+}
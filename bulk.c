@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Bulk rolls for preparing a campaign, e.g. a thousand names at once.  All
+ * tables are looked up once, the results go through one large buffer to
+ * stdout or a file, one result per line as TSV or JSON.  The dice are rolled
+ * in batches of BULK_CHUNK with batch_dice().  Bulk rolls prepare a campaign
+ * and are not played, so their dice are not written to the audit log.
+ */
+
+#include <sys/param.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isscrolls.h"
+
+#define BULK_BUFSIZE	(1024 * 1024)
+#define BULK_CHUNK	4096
+#define BULK_MAXFIELDS	8
+#define BULK_MAXTOKENS	5
+
+enum bulk_format {
+	BULK_TSV,
+	BULK_JSON,
+};
+
+struct bulk_field {
+	const char	*name;
+	int		 what;
+};
+
+/* Generators roll on several tables for one result, like generatenpc */
+static const struct bulk_generator {
+	const char		*name;
+	struct bulk_field	 fields[BULK_MAXFIELDS];
+	int			 nfields;
+} generators[] = {
+	{ "npc", {
+		{ "name", ORACLE_IS_NAMES },
+		{ "role", ORACLE_CHAR_ROLE },
+		{ "descriptor", ORACLE_CHAR_DESC },
+		{ "goal", ORACLE_CHAR_GOAL },
+		{ "disposition", ORACLE_CHAR_DISPOSITION },
+		{ "activity", ORACLE_CHAR_ACTIVITY } }, 6 },
+};
+
+static void
+bulk_usage(void)
+{
+	printf("Please provide a table or generator and a count\n\n");
+	printf("> roll <table|npc> <count> [tsv|json] [file]\n\n");
+	printf("Examples:\n");
+	printf("> roll names/elf 100\t\t- 100 Elf names as TSV\n");
+	printf("> roll npc 1000 json npcs.json\t- 1000 NPCs as JSON lines\n");
+}
+
+/* Write a string as TSV field or JSON string */
+static void
+write_escaped(FILE *out, const char *s, size_t len, enum bulk_format format)
+{
+	const char *end = s + len, *p;
+
+	/* Plain text is the common case, write it in one go */
+	if (format == BULK_TSV && memchr(s, '\t', len) == NULL &&
+	    memchr(s, '\n', len) == NULL && memchr(s, '\r', len) == NULL) {
+		fwrite(s, 1, len, out);
+		return;
+	}
+
+	for (p = s; p < end; p++) {
+		switch (format) {
+		case BULK_TSV:
+			putc(*p == '\t' || *p == '\n' || *p == '\r' ? ' ' : *p, out);
+			break;
+		case BULK_JSON:
+			if (*p == '"' || *p == '\\')
+				fprintf(out, "\\%c", *p);
+			else if ((unsigned char)*p < 0x20)
+				fprintf(out, "\\u%04x", (unsigned char)*p);
+			else
+				putc(*p, out);
+			break;
+		}
+	}
+}
+
+/*
+ * Results that need expansion go through the scratch stream first, they have
+ * to be escaped before they go out
+ */
+static void
+write_roll(FILE *out, FILE *scratch, char **buf, const struct oracle_table *t,
+	long die, enum bulk_format format)
+{
+	const char *plain;
+	off_t len;
+
+	if ((plain = oracle_plain(t, die)) != NULL) {
+		write_escaped(out, plain, strlen(plain), format);
+		return;
+	}
+
+	fseeko(scratch, 0, SEEK_SET);
+	oracle_expand(scratch, t, die);
+	fflush(scratch);
+	if ((len = ftello(scratch)) > 0)
+		write_escaped(out, *buf, len, format);
+}
+
+/*
+ * Roll n dice at once, dice with more than 255 sides and dice from the kernel
+ * are rolled one by one
+ */
+static void
+roll_dice(struct dice_batch *b, long *out, size_t n, long sides)
+{
+	uint8_t dice[BULK_CHUNK];
+	size_t i;
+
+	if (sides > UINT8_MAX || get_dice_source() == DICE_ENTROPY) {
+		for (i = 0; i < n; i++)
+			out[i] = roll_die(sides);
+		return;
+	}
+
+	batch_dice(b, dice, n, sides);
+	for (i = 0; i < n; i++)
+		out[i] = dice[i];
+}
+
+static void
+roll_table(FILE *out, FILE *scratch, char **buf, const char *name,
+	const struct oracle_table *t, long long count, enum bulk_format format)
+{
+	struct dice_batch b;
+	long dice[BULK_CHUNK];
+	long long i;
+	long die;
+
+	if (format == BULK_TSV)
+		fprintf(out, "roll\t%s\n", name);
+
+	batch_seed(&b, get_dice_rng());
+	for (i = 0; i < count; i++) {
+		if (i % BULK_CHUNK == 0)
+			roll_dice(&b, dice, MIN(count - i, BULK_CHUNK), t->dice);
+		die = dice[i % BULK_CHUNK];
+		switch (format) {
+		case BULK_TSV:
+			fprintf(out, "%ld\t", die);
+			write_roll(out, scratch, buf, t, die, format);
+			putc('\n', out);
+			break;
+		case BULK_JSON:
+			fprintf(out, "{\"table\":\"%s\",\"roll\":%ld,\"result\":\"",
+				name, die);
+			write_roll(out, scratch, buf, t, die, format);
+			fputs("\"}\n", out);
+			break;
+		}
+	}
+}
+
+static void
+roll_generator(FILE *out, FILE *scratch, char **buf,
+	const struct bulk_generator *g, long long count, enum bulk_format format)
+{
+	const struct oracle_table *t[BULK_MAXFIELDS];
+	static long rolls[BULK_MAXFIELDS][BULK_CHUNK];
+	struct dice_batch b;
+	long dice[BULK_MAXFIELDS];
+	long long i;
+	int j;
+
+	for (j = 0; j < g->nfields; j++) {
+		if ((t[j] = get_oracle_table(g->fields[j].what)) == NULL)
+			log_errx(1, "Cannot load oracle table %s\n",
+				oracle_path(g->fields[j].what));
+		dice[j] = oracle_dice(g->fields[j].what, t[j]);
+	}
+
+	if (format == BULK_TSV) {
+		for (j = 0; j < g->nfields; j++)
+			fprintf(out, "%s%c", g->fields[j].name,
+				j == g->nfields - 1 ? '\n' : '\t');
+	}
+
+	batch_seed(&b, get_dice_rng());
+	for (i = 0; i < count; i++) {
+		if (i % BULK_CHUNK == 0) {
+			for (j = 0; j < g->nfields; j++)
+				roll_dice(&b, rolls[j], MIN(count - i, BULK_CHUNK),
+					dice[j]);
+		}
+		if (format == BULK_JSON)
+			fprintf(out, "{\"generator\":\"%s\"", g->name);
+		for (j = 0; j < g->nfields; j++) {
+			switch (format) {
+			case BULK_TSV:
+				if (j > 0)
+					putc('\t', out);
+				break;
+			case BULK_JSON:
+				fprintf(out, ",\"%s\":\"", g->fields[j].name);
+				break;
+			}
+			write_roll(out, scratch, buf, t[j],
+				rolls[j][i % BULK_CHUNK], format);
+			if (format == BULK_JSON)
+				putc('"', out);
+		}
+		fputs(format == BULK_JSON ? "}\n" : "\n", out);
+	}
+}
+
+/*
+ * Roll count times on a table or generator.  The arguments are the table or
+ * generator, the count and optionally the format and an output file.
+ * Returns 0 on success, 1 on bad arguments and 2 on I/O errors.
+ */
+int
+bulk_roll(int argc, char **argv)
+{
+	const struct bulk_generator *g = NULL;
+	const struct oracle_table *t = NULL;
+	enum bulk_format format = BULK_TSV;
+	long long count;
+	size_t i, len;
+	char *ep, *buf = NULL;
+	FILE *out, *scratch;
+	int fd, ret = 0;
+
+	if (argc < 2 || argc > 4) {
+		bulk_usage();
+		return 1;
+	}
+
+	errno = 0;
+	count = strtoll(argv[1], &ep, 10);
+	if (argv[1][0] == '\0' || *ep != '\0') {
+		printf("Please provide a number as count\n");
+		return 1;
+	}
+	if (errno == ERANGE || count <= 0) {
+		printf("Please provide a count of at least 1\n");
+		return 1;
+	}
+
+	if (argc > 2) {
+		if (strcmp(argv[2], "json") == 0)
+			format = BULK_JSON;
+		else if (strcmp(argv[2], "tsv") != 0) {
+			printf("Unknown format %s, use tsv or json\n", argv[2]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < sizeof(generators) / sizeof(generators[0]); i++)
+		if (strcmp(argv[0], generators[i].name) == 0)
+			g = &generators[i];
+
+	if (g == NULL && (t = lookup_oracle_table(argv[0])) == NULL) {
+		printf("Unknown oracle table or generator %s\n", argv[0]);
+		return 1;
+	}
+
+	/* Use an own stream for stdout, it has to be fully buffered */
+	fflush(stdout);
+	if (argc > 3)
+		out = fopen(argv[3], "w");
+	else if ((fd = dup(STDOUT_FILENO)) == -1 || (out = fdopen(fd, "w")) == NULL)
+		out = NULL;
+	if (out == NULL) {
+		printf("Cannot open %s\n", argc > 3 ? argv[3] : "stdout");
+		return 2;
+	}
+	setvbuf(out, NULL, _IOFBF, BULK_BUFSIZE);
+
+	if ((scratch = open_memstream(&buf, &len)) == NULL)
+		log_errx(1, "open_memstream");
+
+	pause_audit(1);
+	if (g != NULL)
+		roll_generator(out, scratch, &buf, g, count, format);
+	else
+		roll_table(out, scratch, &buf, argv[0], t, count, format);
+	pause_audit(0);
+
+	fclose(scratch);
+	free(buf);
+
+	if (fclose(out) != 0) {
+		printf("Cannot write %s\n", argc > 3 ? argv[3] : "stdout");
+		ret = 2;
+	}
+
+	return ret;
+}
+
+void
+cmd_roll_bulk(char *cmd)
+{
+	char *tokens[BULK_MAXTOKENS];
+	char *p, *last;
+	int i = 0;
+
+	/* Count all tokens, so extra arguments end up in the usage */
+	for ((p = strtok_r(cmd, " ", &last)); p;
+		(p = strtok_r(NULL, " ", &last))) {
+		if (i < BULK_MAXTOKENS - 1)
+			tokens[i] = p;
+		i++;
+	}
+	tokens[MIN(i, BULK_MAXTOKENS - 1)] = NULL;
+
+	bulk_roll(i, tokens);
+}
@@ -0,0 +1,753 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isscrolls.h"
+
+/*
+ * Binary cache of the oracle tables of one JSON file.  It is written to the
+ * isscrolls directory after a JSON file was parsed and mapped read-only by
+ * later sessions.  The layout is as follows:
+ *
+ * struct cache_header
+ * struct cache_table[ntables]
+ * struct oracle_entry[]	entries of all tables in order of their range
+ * uint16_t index[]		entry for each roll, dice + 1 per table
+ * char strings[]		NUL terminated names and entries, strings[0] is ""
+ */
+#define CACHE_MAGIC	"ISOC"
+#define CACHE_VERSION	3
+
+struct cache_header {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	size;
+	uint32_t	ntables;
+	int64_t		src_mtime;
+	uint64_t	src_size;
+	uint64_t	src_hash;
+	uint32_t	tables_off;
+	uint32_t	strings_off;
+};
+
+struct cache_table {
+	uint32_t	name;
+	uint32_t	nentries;
+	uint32_t	dice;
+	uint32_t	entries_off;
+	uint32_t	index_off;
+	uint32_t	unused;
+};
+
+/*
+ * Registry of the oracle tables, a hash map from the table name to the table.
+ * Tables are registered when their cache is mapped or, without -j, from the
+ * tables compiled into the binary.  A table counts as resident once it was
+ * looked up, its entries are compiled for oracle_expand() at that point.
+ * The tables are allocated one by one, so pointers to them stay valid when
+ * the registry grows.
+ */
+struct oracle_slot {
+	struct oracle_table	*table;
+	int			 resident;
+};
+
+static struct oracle_slot *registry = NULL;
+static size_t registry_size = 0;
+static size_t registry_count = 0;
+static size_t resident_tables = 0;
+static size_t resident_bytes = 0;
+static int json_oracles = 0;
+
+/* 32 bit FNV-1a hash of a table name */
+static uint32_t
+hash_name(const char *name)
+{
+	uint32_t h = 0x811c9dc5;
+
+	for (; *name != '\0'; name++) {
+		h ^= (unsigned char)*name;
+		h *= 0x01000193;
+	}
+
+	return h;
+}
+
+/*
+ * Return the slot of the table with the given name or the free slot where it
+ * belongs.  Open addressing with linear probing, the registry is at most half
+ * full, so there is always a free slot.
+ */
+static struct oracle_slot *
+find_slot(const char *name)
+{
+	size_t i;
+
+	if (registry_size == 0)
+		return NULL;
+
+	i = hash_name(name) & (registry_size - 1);
+	while (registry[i].table != NULL &&
+	    strcmp(registry[i].table->name, name) != 0)
+		i = (i + 1) & (registry_size - 1);
+
+	return &registry[i];
+}
+
+static size_t
+table_size(const struct oracle_table *t)
+{
+	const struct oracle_entry *last = &t->entries[t->nentries - 1];
+	size_t strings;
+
+	strings = last->str + strlen(t->strings + last->str) + 1 -
+		t->entries[0].str;
+
+	return t->nentries * sizeof(*t->entries) +
+		(t->dice + 1) * sizeof(*t->index) + strings;
+}
+
+static void
+register_oracle_table(const struct oracle_table *t)
+{
+	struct oracle_slot *old, *slot;
+	size_t i, size;
+
+	if (2 * (registry_count + 1) > registry_size) {
+		old = registry;
+		size = registry_size;
+		registry_size = size ? size * 2 : 256;
+		if ((registry = calloc(registry_size, sizeof(*registry))) == NULL)
+			log_errx(1, "calloc");
+		for (i = 0; i < size; i++) {
+			if (old[i].table != NULL)
+				*find_slot(old[i].table->name) = old[i];
+		}
+		free(old);
+	}
+
+	slot = find_slot(t->name);
+	if (slot->table != NULL) {
+		/* Reloaded, only the contents change */
+		if (slot->resident)
+			resident_bytes -= table_size(slot->table);
+		free_oracle_prog(slot->table->prog);
+		*slot->table = *t;
+		if (slot->resident)
+			resident_bytes += table_size(slot->table);
+		return;
+	}
+
+	if ((slot->table = malloc(sizeof(*slot->table))) == NULL)
+		log_errx(1, "malloc");
+	*slot->table = *t;
+	registry_count++;
+	completion_changed(COMPLETE_ORACLES);
+}
+
+/*
+ * After a reload, compile the tables that were in use again and forget all
+ * resolved references, they might point to tables that changed
+ */
+static void
+recompile_oracle_tables(void)
+{
+	size_t i;
+
+	for (i = 0; i < registry_size; i++) {
+		if (registry[i].table == NULL || !registry[i].resident)
+			continue;
+		if (registry[i].table->prog == NULL)
+			registry[i].table->prog =
+				compile_oracle_table(registry[i].table);
+		else
+			reset_oracle_prog(registry[i].table->prog);
+	}
+}
+
+/* Check if a registered table still uses the given cache */
+static int
+points_into(const unsigned char *base, size_t size)
+{
+	const char *name;
+	size_t i;
+
+	for (i = 0; i < registry_size; i++) {
+		if (registry[i].table == NULL)
+			continue;
+		name = registry[i].table->name;
+		if (name >= (const char *)base && name < (const char *)base + size)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+cache_paths(const struct oracle_source *s, char *src, char *dst, size_t len)
+{
+	const char *ext, *file = s->file;
+	int ret;
+
+	ret = snprintf(src, len, "%s/%s", s->dir, file);
+	if (ret < 0 || (size_t)ret >= len) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", src);
+	}
+
+	if ((ext = strrchr(file, '.')) == NULL)
+		ext = file + strlen(file);
+
+	ret = snprintf(dst, len, "%s/%.*s.cache", get_isscrolls_dir(),
+		(int)(ext - file), file);
+	if (ret < 0 || (size_t)ret >= len) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", dst);
+	}
+}
+
+/* 64 bit FNV-1a hash of a whole file */
+static int
+hash_file(const char *path, uint64_t *hash)
+{
+	unsigned char buf[16384];
+	ssize_t n, i;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			h ^= buf[i];
+			h *= 0x100000001b3ULL;
+		}
+	}
+	close(fd);
+
+	if (n == -1)
+		return -1;
+
+	*hash = h;
+	return 0;
+}
+
+static int
+validate_cache(const unsigned char *base, size_t len)
+{
+	const struct cache_header *hdr = (const struct cache_header *)base;
+	const struct cache_table *t;
+	const struct oracle_entry *e;
+	const uint16_t *index;
+	size_t strings_len;
+	uint32_t i, j;
+
+	if (len < sizeof(*hdr))
+		return -1;
+	if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != CACHE_VERSION || hdr->size != len)
+		return -1;
+	if (hdr->strings_off >= len || base[len - 1] != '\0' ||
+	    hdr->tables_off > hdr->strings_off ||
+	    hdr->ntables > (hdr->strings_off - hdr->tables_off) / sizeof(*t))
+		return -1;
+
+	strings_len = len - hdr->strings_off;
+	t = (const struct cache_table *)(base + hdr->tables_off);
+	for (i = 0; i < hdr->ntables; i++, t++) {
+		if (t->name == 0 || t->name >= strings_len ||
+		    t->nentries == 0 || t->dice == 0 ||
+		    t->entries_off % sizeof(*e) || t->index_off % sizeof(*index) ||
+		    t->entries_off > hdr->strings_off ||
+		    t->index_off > hdr->strings_off ||
+		    t->nentries > (hdr->strings_off - t->entries_off) / sizeof(*e) ||
+		    t->dice >= (hdr->strings_off - t->index_off) / sizeof(*index))
+			return -1;
+
+		e = (const struct oracle_entry *)(base + t->entries_off);
+		for (j = 0; j < t->nentries; j++)
+			if (e[j].str >= strings_len)
+				return -1;
+
+		index = (const uint16_t *)(base + t->index_off);
+		for (j = 1; j <= t->dice; j++)
+			if (index[j] >= t->nentries)
+				return -1;
+	}
+
+	return 0;
+}
+
+static void
+cache_oracle_table(const unsigned char *base, uint32_t i,
+	struct oracle_table *ot)
+{
+	const struct cache_header *hdr = (const struct cache_header *)base;
+	const struct cache_table *t;
+
+	t = (const struct cache_table *)(base + hdr->tables_off) + i;
+	ot->name = (const char *)(base + hdr->strings_off + t->name);
+	ot->nentries = t->nentries;
+	ot->dice = t->dice;
+	ot->entries = (const struct oracle_entry *)(base + t->entries_off);
+	ot->index = (const uint16_t *)(base + t->index_off);
+	ot->strings = (const char *)(base + hdr->strings_off);
+	ot->prog = NULL;
+}
+
+static void
+install_cache(const unsigned char *base)
+{
+	const struct cache_header *hdr = (const struct cache_header *)base;
+	struct oracle_table ot;
+	uint32_t i;
+
+	for (i = 0; i < hdr->ntables; i++) {
+		cache_oracle_table(base, i, &ot);
+		register_oracle_table(&ot);
+	}
+}
+
+/* The cache that check_oracle_file() looks into before it is installed */
+static const unsigned char *checked_cache;
+
+static const struct oracle_table *
+lookup_cached_table(const char *name)
+{
+	const struct cache_header *hdr = (const struct cache_header *)checked_cache;
+	static struct oracle_table ot;
+	uint32_t i;
+
+	for (i = 0; i < hdr->ntables; i++) {
+		cache_oracle_table(checked_cache, i, &ot);
+		if (strcmp(ot.name, name) == 0)
+			return &ot;
+	}
+
+	return NULL;
+}
+
+/*
+ * Write a cache with the given header to a temporary file and rename it into
+ * place, so nobody ever sees a partly written cache
+ */
+static void
+write_cache(const char *dst, const struct cache_header *hdr,
+	const unsigned char *base, size_t size)
+{
+	char tmp[_POSIX_PATH_MAX];
+	size_t len = size - sizeof(*hdr);
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXXXXXX", dst);
+	if ((fd = mkstemp(tmp)) == -1) {
+		log_debug("Cannot create %s\n", tmp);
+		return;
+	}
+
+	if (write(fd, hdr, sizeof(*hdr)) != (ssize_t)sizeof(*hdr) ||
+	    write(fd, base + sizeof(*hdr), len) != (ssize_t)len ||
+	    fchmod(fd, 0644) == -1) {
+		log_debug("Cannot write oracle cache %s\n", tmp);
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+
+	if (rename(tmp, dst) == -1) {
+		log_debug("Cannot rename %s to %s\n", tmp, dst);
+		unlink(tmp);
+		return;
+	}
+
+	log_debug("Wrote oracle cache %s\n", dst);
+}
+
+static int
+load_oracle_cache(struct oracle_source *s)
+{
+	char src[_POSIX_PATH_MAX], dst[_POSIX_PATH_MAX];
+	struct cache_header *hdr, nhdr;
+	struct stat ss, cs;
+	unsigned char *base;
+	uint64_t hash;
+	int fd;
+
+	cache_paths(s, src, dst, sizeof(src));
+
+	if (stat(src, &ss) == -1)
+		return -1;
+
+	if ((fd = open(dst, O_RDONLY)) == -1) {
+		log_debug("No oracle cache %s\n", dst);
+		return -1;
+	}
+
+	if (fstat(fd, &cs) == -1 || cs.st_size < (off_t)sizeof(*hdr) ||
+	    cs.st_size > UINT32_MAX) {
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, cs.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	if (validate_cache(base, cs.st_size) == -1) {
+		log_debug("Invalid oracle cache %s\n", dst);
+		goto fail;
+	}
+
+	hdr = (struct cache_header *)base;
+	if (hdr->src_mtime != (int64_t)ss.st_mtime ||
+	    hdr->src_size != (uint64_t)ss.st_size) {
+		/* The file was touched, so check if its content changed */
+		if (hash_file(src, &hash) == -1 || hash != hdr->src_hash) {
+			log_debug("Oracle cache %s is outdated\n", dst);
+			goto fail;
+		}
+
+		/*
+		 * Content is the same, remember the new mtime for next time.
+		 * Other sessions may have the cache mapped, so it is replaced
+		 * instead of changed in place.
+		 */
+		nhdr = *hdr;
+		nhdr.src_mtime = ss.st_mtime;
+		write_cache(dst, &nhdr, base, cs.st_size);
+	}
+
+	close(fd);
+
+	install_cache(base);
+	s->base = base;
+	s->size = cs.st_size;
+	s->mapped = 1;
+	s->mtime = ss.st_mtime;
+
+	log_debug("Mapped oracle cache %s\n", dst);
+
+	return 0;
+
+fail:
+	munmap(base, cs.st_size);
+	close(fd);
+	return -1;
+}
+
+/*
+ * Write all tables parsed from a JSON file into its cache and serve them from
+ * there.  Returns -1 if a table does not cover all rolls of its die or a roll
+ * does not match the JSON file.
+ */
+static int
+build_oracle_cache(struct oracle_source *s)
+{
+	char src[_POSIX_PATH_MAX], dst[_POSIX_PATH_MAX], err[1024];
+	struct cache_header *hdr;
+	struct cache_table *t;
+	struct oracle_entry *e;
+	struct stat ss;
+	unsigned char *base;
+	uint16_t *index;
+	const char *row, *name;
+	size_t size, nentries = 0, nindex = 0, strings_len = 1, off, len;
+	size_t ntables, n;
+	int id, dice;
+
+	cache_paths(s, src, dst, sizeof(src));
+
+	ntables = oracle_array_count();
+	for (n = 0; n < ntables; n++) {
+		strings_len += strlen(oracle_array_name(n)) + 1;
+		nindex += oracle_array_rows(n);
+		for (id = 0; id < oracle_array_rows(n); id++) {
+			if ((len = oracle_array_row_len(n, id)) > 0) {
+				strings_len += len + 1;
+				nentries++;
+			}
+		}
+	}
+
+	size = sizeof(*hdr) + ntables * sizeof(*t) + nentries * sizeof(*e) +
+		nindex * sizeof(*index) + strings_len;
+	if ((base = calloc(1, size)) == NULL)
+		log_errx(1, "calloc");
+
+	hdr = (struct cache_header *)base;
+	memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->version = CACHE_VERSION;
+	hdr->size = size;
+	hdr->ntables = ntables;
+	hdr->tables_off = sizeof(*hdr);
+	hdr->strings_off = size - strings_len;
+
+	if (stat(src, &ss) == 0 && hash_file(src, &hdr->src_hash) == 0) {
+		hdr->src_mtime = ss.st_mtime;
+		hdr->src_size = ss.st_size;
+		s->mtime = ss.st_mtime;
+	}
+
+	t = (struct cache_table *)(base + hdr->tables_off);
+	e = (struct oracle_entry *)(t + ntables);
+	index = (uint16_t *)(e + nentries);
+	off = 1;
+	for (n = 0; n < ntables; n++, t++) {
+		dice = oracle_array_rows(n) - 1;
+		name = oracle_array_name(n);
+		len = strlen(name);
+		memcpy(base + hdr->strings_off + off, name, len + 1);
+		t->name = off;
+		off += len + 1;
+		t->dice = dice;
+		t->entries_off = (unsigned char *)e - base;
+		t->index_off = (unsigned char *)index - base;
+
+		/* Every non-empty row is an entry covering the rolls up to its id */
+		for (id = 1; id <= dice; id++) {
+			row = oracle_array_row(n, id);
+			if ((len = oracle_array_row_len(n, id)) == 0)
+				continue;
+			e[t->nentries].str = off;
+			e[t->nentries].low = t->nentries ? e[t->nentries - 1].high + 1 : 1;
+			e[t->nentries].high = id;
+			memcpy(base + hdr->strings_off + off, row, len + 1);
+			off += len + 1;
+			t->nentries++;
+		}
+
+		if (build_oracle_index(e, t->nentries, index, dice) == -1) {
+			log_debug("%s: table %s does not cover all rolls\n",
+				s->file, name);
+			free(base);
+			return -1;
+		}
+
+		e += t->nentries;
+		index += dice + 1;
+	}
+
+	/* Every roll of every table against the "Chance" ranges of the file */
+	checked_cache = base;
+	if (check_oracle_file(s, lookup_cached_table, err, sizeof(err)) == -1) {
+		log_debug("%s: %s\n", s->file, err);
+		free(base);
+		return -1;
+	}
+
+	/* Even if the cache cannot be written, the tables are served from memory */
+	install_cache(base);
+	s->base = base;
+	s->size = size;
+	s->mapped = 0;
+
+	write_cache(dst, hdr, base, size);
+
+	return 0;
+}
+
+/* Read the oracle tables from the JSON files instead of the built-in ones */
+void
+use_json_oracles()
+{
+	json_oracles = 1;
+}
+
+static void
+load_oracle_source(struct oracle_source *s)
+{
+	if (s->loaded)
+		return;
+
+	if (load_oracle_cache(s) == 0) {
+		s->loaded = 1;
+		return;
+	}
+
+	log_debug("No valid cache for %s.  Parse the JSON file\n", s->file);
+	if (read_oracle_file(s) == -1)
+		log_errx(1, "Cannot open %s/%s\n", s->dir, s->file);
+	if (build_oracle_cache(s) == -1)
+		log_errx(1, "%s: a table does not match its rolls\n", s->file);
+	s->loaded = 1;
+
+	/* The tables are served from the cache now, drop the parsed JSON */
+	free_oracle_arrays();
+}
+
+/*
+ * Parse a changed JSON file again and replace its tables.  The tables keep
+ * their place in the registry and only get new contents, so references to
+ * them stay valid.  If the file is broken, the old tables stay in use.
+ * Must not be called while a roll is in progress.
+ */
+int
+reload_oracle_source(struct oracle_source *s)
+{
+	unsigned char *base = s->base;
+	size_t size = s->size;
+	int mapped = s->mapped;
+
+	/* Nothing of it is registered, the next lookup reads the new file */
+	if (!s->loaded)
+		return 0;
+
+	if (read_oracle_file(s) == -1 || build_oracle_cache(s) == -1) {
+		printf("Cannot reload %s/%s, keeping the old tables\n", s->dir,
+			s->file);
+		free_oracle_arrays();
+		return -1;
+	}
+	free_oracle_arrays();
+
+	recompile_oracle_tables();
+
+	/* Tables that are gone from the file still live in the old cache */
+	if (points_into(base, size)) {
+		log_debug("Keeping the old tables of %s/%s\n", s->dir, s->file);
+		return 0;
+	}
+
+	if (mapped)
+		munmap(base, size);
+	else
+		free(base);
+
+	log_debug("Reloaded %s/%s\n", s->dir, s->file);
+
+	return 0;
+}
+
+/* Register the tables compiled into the binary by mkoracles */
+static void
+load_builtin_tables(void)
+{
+	static int loaded = 0;
+	const struct oracle_table *b;
+
+	if (loaded)
+		return;
+
+	for (b = builtin_tables; b->name != NULL; b++)
+		register_oracle_table(b);
+
+	loaded = 1;
+}
+
+/* Make sure that every table is registered, e.g. to list them */
+void
+load_all_oracle_tables()
+{
+	struct oracle_source *sources;
+	size_t i, n;
+
+	if (!json_oracles) {
+		load_builtin_tables();
+		return;
+	}
+
+	sources = get_oracle_sources(&n);
+	for (i = 0; i < n; i++)
+		load_oracle_source(&sources[i]);
+}
+
+
+/*
+ * Look up a table by its name, e.g. "settlement/trouble".  If it is not
+ * registered yet, only the JSON file or cache that provides it is loaded.
+ */
+const struct oracle_table *
+lookup_oracle_table(const char *name)
+{
+	struct oracle_source *s;
+	struct oracle_slot *slot;
+
+	if ((slot = find_slot(name)) == NULL || slot->table == NULL) {
+		if (!json_oracles)
+			load_builtin_tables();
+		else if ((s = find_oracle_source(name)) != NULL)
+			load_oracle_source(s);
+
+		if ((slot = find_slot(name)) == NULL || slot->table == NULL)
+			return NULL;
+	}
+
+	if (!slot->resident) {
+		slot->resident = 1;
+		resident_tables++;
+		resident_bytes += table_size(slot->table);
+		log_debug("Loaded oracle table %s, %zu tables with %zu bytes resident\n",
+			name, resident_tables, resident_bytes);
+		slot->table->prog = compile_oracle_table(slot->table);
+	}
+
+	return slot->table;
+}
+
+/* Check if a table is registered without loading anything */
+int
+has_oracle_table(const char *name)
+{
+	struct oracle_slot *slot;
+
+	return (slot = find_slot(name)) != NULL && slot->table != NULL;
+}
+
+const struct oracle_table *
+get_oracle_table(int what)
+{
+	const char *name;
+
+	if ((name = oracle_path(what)) == NULL)
+		return NULL;
+
+	return lookup_oracle_table(name);
+}
+
+/*
+ * Iterate over the names of all registered tables.  Start with *iter = 0,
+ * returns NULL after the last one.
+ */
+const char *
+next_oracle_table_name(size_t *iter)
+{
+	while (*iter < registry_size) {
+		if (registry[(*iter)++].table != NULL)
+			return registry[*iter - 1].table->name;
+	}
+
+	return NULL;
+}
+
+void
+get_oracle_resident(size_t *ntables, size_t *nbytes)
+{
+	*ntables = resident_tables;
+	*nbytes = resident_bytes;
+}
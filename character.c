@@ -29,6 +29,15 @@
 #include "isscrolls.h"
 
 static struct character *curchar = NULL;
+static int next_answer = 0;
+
+/* The current character as it was loaded, to see if it changed */
+static struct {
+	char		*json;
+	struct journey	 j;
+	struct fight	 fight;
+	struct delve	 delve;
+} snapshot;
 static LIST_HEAD(listhead, entry) head = LIST_HEAD_INITIALIZER(head);
 
 void
@@ -53,6 +62,7 @@ cmd_create_character(char *name)
 	log_debug("Attempt to create a character named %s\n", name);
 	if ((c = create_character(name)) != NULL) {
 		curchar = c;
+		set_dice_rng(&c->dice);
 		print_character();
 		snprintf(p, sizeof(p), "%s > ", c->name);
 		set_prompt(p);
@@ -63,6 +73,7 @@ cmd_create_character(char *name)
 		e->id = c->id;
 		snprintf(e->name, sizeof(e->name), "%s", c->name);
 		LIST_INSERT_HEAD(&head, e, entries);
+		completion_changed(COMPLETE_CHARACTERS);
 	}
 }
 
@@ -97,6 +108,7 @@ cmd_delete_character(__attribute__((unused)) char *unused)
 	if (np != NULL) {
 		LIST_REMOVE(np, entries);
 		free(np);
+		completion_changed(COMPLETE_CHARACTERS);
 	} else
 		log_debug("Found a list entry but cannot delete it\n");
 
@@ -240,6 +252,7 @@ update_prompt()
 	char j[MAX_PROMPT_LEN];
 	char f[MAX_PROMPT_LEN];
 	char d[MAX_PROMPT_LEN];
+	char fc[16];
 	char i[5];
 
 	CURCHAR_CHECK();
@@ -247,33 +260,36 @@ update_prompt()
 	j[0] = f[0] = d[0] = i[0] = '\0';
 
 	if (curchar->journey_active) {
+		forecast_prompt(fc, sizeof(fc), FORECAST_JOURNEY);
 		if (curchar->j->difficulty < 4)
-			snprintf(j, sizeof(j), "Journey %.0f/10 > ",
-				curchar->j->progress);
+			snprintf(j, sizeof(j), "Journey %.0f/10%s > ",
+				curchar->j->progress, fc);
 		else
-			snprintf(j, sizeof(j), "Journey %.2f/10 > ",
-				curchar->j->progress);
+			snprintf(j, sizeof(j), "Journey %.2f/10%s > ",
+				curchar->j->progress, fc);
 	}
 
 	if (curchar->delve_active) {
+		forecast_prompt(fc, sizeof(fc), FORECAST_DELVE);
 		if (curchar->delve->difficulty < 4)
-			snprintf(d, sizeof(d), "Delve %.0f/10 > ",
-				curchar->delve->progress);
+			snprintf(d, sizeof(d), "Delve %.0f/10%s > ",
+				curchar->delve->progress, fc);
 		else
-			snprintf(d, sizeof(d), "Delve %.2f/10 > ",
-				curchar->delve->progress);
+			snprintf(d, sizeof(d), "Delve %.2f/10%s > ",
+				curchar->delve->progress, fc);
 	}
 
 	if (curchar->fight_active) {
 		if (curchar->fight->initiative)
 			snprintf(i, 5, "%s", " [I]");
 
+		forecast_prompt(fc, sizeof(fc), FORECAST_FIGHT);
 		if (curchar->fight->difficulty < 4)
-			snprintf(f, sizeof(f), "Fight %.0f/10%s > ",
-				curchar->fight->progress, i);
+			snprintf(f, sizeof(f), "Fight %.0f/10%s%s > ",
+				curchar->fight->progress, i, fc);
 		else
-			snprintf(f, sizeof(f), "Fight %.2f/10%s > ",
-				curchar->fight->progress, i);
+			snprintf(f, sizeof(f), "Fight %.2f/10%s%s > ",
+				curchar->fight->progress, i, fc);
 	}
 
 	snprintf(p, sizeof(p), "%s > %s%s%s", curchar->name, j, d, f);
@@ -462,24 +478,14 @@ save_current_character()
 	save_character();
 }
 
-void
-save_character()
+/* The current character as it is saved in characters.json */
+static json_object *
+character_json(void)
 {
-	char path[_POSIX_PATH_MAX];
-	json_object *root, *items;
-	size_t temp_n, i;
-	int ret;
-
-	if (curchar == NULL) {
-		log_debug("Nothing to save here\n");
-		return;
-	}
-
-	save_journey();
-	save_fight();
-	save_delve();
-
 	json_object *cobj = json_object_new_object();
+	json_object *state;
+	int i;
+
 	json_object_object_add(cobj, "name", json_object_new_string(curchar->name));
 	json_object_object_add(cobj, "id", json_object_new_int(curchar->id));
 	json_object_object_add(cobj, "edge", json_object_new_int(curchar->edge));
@@ -523,6 +529,85 @@ save_character()
 		json_object_new_int(curchar->fight_active));
 	json_object_object_add(cobj, "delve_active",
 		json_object_new_int(curchar->delve_active));
+	save_decks(cobj);
+	json_object_object_add(cobj, "dice_seed",
+		json_object_new_int64((int64_t)curchar->dice.seed));
+	json_object_object_add(cobj, "dice_position",
+		json_object_new_int64((int64_t)curchar->dice.pos));
+	state = json_object_new_array();
+	for (i = 0; i < 4; i++)
+		json_object_array_add(state,
+			json_object_new_int64((int64_t)curchar->dice.s[i]));
+	json_object_object_add(cobj, "dice_state", state);
+
+	return cobj;
+}
+
+/* Remember the current character, e.g. to save it only if it changed */
+void
+snapshot_character()
+{
+	json_object *cobj;
+
+	free(snapshot.json);
+	snapshot.json = NULL;
+	if (curchar == NULL)
+		return;
+
+	cobj = character_json();
+	if ((snapshot.json = strdup(json_object_to_json_string(cobj))) == NULL)
+		log_errx(1, "strdup");
+	json_object_put(cobj);
+	memcpy(&snapshot.j, curchar->j, sizeof(snapshot.j));
+	memcpy(&snapshot.fight, curchar->fight, sizeof(snapshot.fight));
+	memcpy(&snapshot.delve, curchar->delve, sizeof(snapshot.delve));
+}
+
+/* Whether the current character differs from the snapshot */
+int
+character_changed()
+{
+	json_object *cobj;
+	int changed;
+
+	if (curchar == NULL || snapshot.json == NULL)
+		return curchar != NULL;
+
+	if (memcmp(&snapshot.j, curchar->j, sizeof(snapshot.j)) != 0 ||
+	    memcmp(&snapshot.fight, curchar->fight, sizeof(snapshot.fight)) != 0 ||
+	    memcmp(&snapshot.delve, curchar->delve, sizeof(snapshot.delve)) != 0)
+		return 1;
+
+	cobj = character_json();
+	changed = strcmp(snapshot.json, json_object_to_json_string(cobj)) != 0;
+	json_object_put(cobj);
+
+	return changed;
+}
+
+void
+save_character()
+{
+	char path[_POSIX_PATH_MAX];
+	json_object *root, *items, *cobj;
+	size_t temp_n, i;
+	int ret;
+
+	if (curchar == NULL) {
+		log_debug("Nothing to save here\n");
+		return;
+	}
+
+	if (saving_disabled()) {
+		log_debug("Saving is disabled\n");
+		return;
+	}
+
+	save_journey();
+	save_fight();
+	save_delve();
+
+	cobj = character_json();
 
 	ret = snprintf(path, sizeof(path), "%s/characters.json", get_isscrolls_dir());
 	if (ret < 0 || (size_t)ret >= sizeof(path)) {
@@ -702,6 +787,7 @@ load_characters_list()
 
 		snprintf(e->name, sizeof(e->name), "%s", json_object_get_string(name));
 		LIST_INSERT_HEAD(&head, e, entries);
+		completion_changed(COMPLETE_CHARACTERS);
 	}
 
 	json_object_put(root);
@@ -715,6 +801,39 @@ load_characters_list()
 	return 0;
 }
 
+/*
+ * Every character rolls with its own dice.  Continue where the last session
+ * of the character stopped, so the same commands give the same results.
+ */
+static void
+load_dice(struct character *c, json_object *cobj)
+{
+	json_object *seed, *pos, *state;
+	uint64_t s[4];
+	size_t i;
+
+	/* Characters from older versions keep the dice from load_character() */
+	if (!json_object_object_get_ex(cobj, "dice_seed", &seed) ||
+	    !json_object_object_get_ex(cobj, "dice_position", &pos))
+		return;
+
+	/* Without the state, e.g. from older versions, replay all numbers */
+	if (json_object_object_get_ex(cobj, "dice_state", &state) &&
+	    json_object_array_length(state) == 4) {
+		for (i = 0; i < 4; i++)
+			s[i] = (uint64_t)json_object_get_int64(
+				json_object_array_get_idx(state, i));
+		if (rng_set_state(&c->dice, (uint64_t)json_object_get_int64(seed),
+		    (uint64_t)json_object_get_int64(pos), s) == 0)
+			goto done;
+	}
+	rng_restore(&c->dice, (uint64_t)json_object_get_int64(seed),
+		(uint64_t)json_object_get_int64(pos));
+done:
+	log_debug("Dice of %s at seed %llu, position %llu\n", c->name,
+		(unsigned long long)c->dice.seed, (unsigned long long)c->dice.pos);
+}
+
 int
 load_character(int id)
 {
@@ -752,6 +871,8 @@ load_character(int id)
 	if ((c->delve = calloc(1, sizeof(struct delve))) == NULL)
 		log_errx(1, "calloc");
 
+	rng_seed(&c->dice, rng_next(get_dice_rng()));
+
 	json_object *characters;
 	if (!json_object_object_get_ex(root, "characters", &characters)) {
 		log_debug("Cannot find a [characters] array in %s\n", path);
@@ -807,10 +928,13 @@ load_character(int id)
 			c->journey_active = validate_int(temp, "journey_active", 0, 1, 0);
 			c->fight_active = validate_int(temp, "fight_active", 0, 1, 0);
 			c->delve_active = validate_int(temp, "delve_active", 0, 1, 0);
+			load_decks(temp);
+			load_dice(c, temp);
 		}
 	}
 
 	curchar = c;
+	set_dice_rng(&c->dice);
 
 	load_journey(c->id);
 	load_fight(c->id);
@@ -1012,22 +1136,40 @@ free_character()
 		free(curchar->delve);
 		curchar->delve = NULL;
 	}
+	free_decks();
+	set_dice_rng(NULL);
 	if (curchar != NULL) {
 		free(curchar);
 		curchar = NULL;
 	}
 }
 
+/* Answer the next question with value instead of asking, e.g. in a simulation */
+void
+set_next_answer(int value)
+{
+	next_answer = value;
+}
+
 int
 ask_for_value(const char *attribute, int max)
 {
 	char *line;
 	int temp = -1;
 
+	if (next_answer > 0) {
+		temp = next_answer;
+		next_answer = 0;
+		if (validate_range(temp, max) == 0)
+			return temp;
+	}
+
 again:
-	line = readline(attribute);
+	if ((line = read_input(attribute)) == NULL)
+		log_errx(1, "The input ended before all questions were answered\n");
 	temp = atoi(line);
 	if (validate_range(temp, max) == -1)	{
+		free(line);
 		goto again;
 	}
 
@@ -1035,6 +1177,18 @@ again:
 	return temp;
 }
 
+/* Names of all characters, iter starts at NULL */
+const char *
+next_character_name(void **iter)
+{
+	struct entry *np = *iter;
+
+	np = np == NULL ? LIST_FIRST(&head) : LIST_NEXT(np, entries);
+	*iter = np;
+
+	return np != NULL ? np->name : NULL;
+}
+
 int
 character_exists(const char *name)
 {
@@ -1061,8 +1215,8 @@ create_character(const char *name)
 
 	if (strlen(name) == 0) {
 		printf("Enter a name for your character: ");
-		c->name = readline(NULL);
-		if (strlen(c->name) == 0) {
+		c->name = read_input(NULL);
+		if (c->name == NULL || strlen(c->name) == 0) {
 			printf("Please provide a longer name\n");
 			free_character();
 			return NULL;
@@ -1107,7 +1261,8 @@ init_character_struct()
 	if ((c->delve = calloc(1, sizeof(struct delve))) == NULL)
 		log_errx(1, "calloc");
 
-	c->id = random();
+	c->id = roll_die(INT32_MAX);
+	rng_seed(&c->dice, rng_next(get_dice_rng()));
 	c->name = NULL;
 	c->edge = c->heart = c->iron = c->shadow = c->wits = c->exp = 0;
 	c->momentum = c->momentum_reset = 2;
@@ -1142,3 +1297,10 @@ get_current_character()
 {
 	return curchar;
 }
+
+/* Switch to c without loading, saving or freeing any character */
+void
+set_current_character(struct character *c)
+{
+	curchar = c;
+}
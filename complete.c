@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Tab completion of commands and their arguments.  Every list of names is
+ * kept as a sorted prefix index, so a completion is a binary search for the
+ * first name with the prefix followed by the matches, no matter how many
+ * characters or oracle tables there are.  An index is built on its first
+ * use and again after its source changed, e.g. a character was created.
+ *
+ * Which index completes an argument follows from the argument schema, a
+ * table of the command and the position of the argument.  Arguments without
+ * a schema fall back to file names, e.g. for replay.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <readline/readline.h>
+
+#include "isscrolls.h"
+
+struct complete_index {
+	void		  (*fill)(struct complete_index *);
+	const char	**words;	/* fixed names, NULL terminated */
+	char		**names;	/* sorted */
+	size_t		  n;
+	size_t		  size;
+	int		  valid;
+};
+
+struct complete_schema {
+	const char		*cmd;
+	int			 arg;	/* position, 0 is the first argument */
+	struct complete_index	*index;
+};
+
+static void fill_words(struct complete_index *);
+static void fill_commands(struct complete_index *);
+static void fill_characters(struct complete_index *);
+static void fill_oracles(struct complete_index *);
+static void fill_macros(struct complete_index *);
+static void fill_odds_moves(struct complete_index *);
+static void fill_advise_moves(struct complete_index *);
+
+static const char *stat_words[] = {
+	"edge", "heart", "iron", "shadow", "wits", NULL
+};
+static const char *value_words[] = {
+	"edge", "heart", "iron", "shadow", "wits", "momentum", "health",
+	"spirit", "supply", "exp", "expspent", "weapon", "progress", NULL
+};
+static const char *odds_words[] = {
+	"edge", "heart", "iron", "shadow", "wits", "health", "spirit",
+	"supply", NULL
+};
+static const char *toggle_words[] = {
+	"wounded", "unprepared", "shaken", "encumbered", "maimed", "cursed",
+	"corrupted", "tormented", NULL
+};
+static const char *yesorno_words[] = {
+	"almostcertain", "likely", "50/50", "unlikely", "smallchance", NULL
+};
+static const char *track_words[] = {
+	"journey", "fight", "delve", NULL
+};
+static const char *forecast_words[] = {
+	"journey", "fight", "delve", "prompt", NULL
+};
+static const char *benchmark_words[] = {
+	"dice", "entropy", "startup", NULL
+};
+static const char *macro_words[] = {
+	"define", "run", "list", "delete", NULL
+};
+static const char *heal_words[] = {
+	"me", "others", NULL
+};
+
+static struct complete_index commands_index = { fill_commands, NULL, NULL, 0, 0, 0 };
+static struct complete_index characters_index = { fill_characters, NULL, NULL, 0, 0, 0 };
+static struct complete_index oracles_index = { fill_oracles, NULL, NULL, 0, 0, 0 };
+static struct complete_index stats_index = { fill_words, stat_words, NULL, 0, 0, 0 };
+static struct complete_index values_index = { fill_words, value_words, NULL, 0, 0, 0 };
+static struct complete_index odds_index = { fill_words, odds_words, NULL, 0, 0, 0 };
+static struct complete_index toggles_index = { fill_words, toggle_words, NULL, 0, 0, 0 };
+static struct complete_index yesorno_index = { fill_words, yesorno_words, NULL, 0, 0, 0 };
+static struct complete_index tracks_index = { fill_words, track_words, NULL, 0, 0, 0 };
+static struct complete_index forecast_index = { fill_words, forecast_words, NULL, 0, 0, 0 };
+static struct complete_index benchmark_index = { fill_words, benchmark_words, NULL, 0, 0, 0 };
+static struct complete_index macros_index = { fill_macros, NULL, NULL, 0, 0, 0 };
+static struct complete_index macro_words_index = { fill_words, macro_words, NULL, 0, 0, 0 };
+static struct complete_index heal_index = { fill_words, heal_words, NULL, 0, 0, 0 };
+static struct complete_index odds_moves_index = { fill_odds_moves, NULL, NULL, 0, 0, 0 };
+static struct complete_index advise_moves_index = { fill_advise_moves, NULL, NULL, 0, 0, 0 };
+
+/* Sorted by command and position, it is searched with bsearch() */
+static const struct complete_schema schemas[] = {
+	{ "advise", 0, &advise_moves_index },
+	{ "battle", 0, &stats_index },
+	{ "benchmark", 0, &benchmark_index },
+	{ "cd", 0, &characters_index },
+	{ "clash", 0, &stats_index },
+	{ "compel", 0, &stats_index },
+	{ "deck", 0, &oracles_index },
+	{ "deck", 1, &oracles_index },
+	{ "decrease", 0, &values_index },
+	{ "delvethedepths", 0, &stats_index },
+	{ "enterthefray", 0, &stats_index },
+	{ "escapethedepths", 0, &stats_index },
+	{ "facedanger", 0, &stats_index },
+	{ "forecast", 0, &forecast_index },
+	{ "forecast", 1, &forecast_index },
+	{ "heal", 0, &heal_index },
+	{ "increase", 0, &values_index },
+	{ "macro", 0, &macro_words_index },
+	{ "macro", 1, &macros_index },
+	{ "odds", 0, &odds_moves_index },
+	{ "odds", 1, &odds_index },
+	{ "oracle", 0, &oracles_index },
+	{ "roll", 0, &oracles_index },
+	{ "secureanadvantage", 0, &stats_index },
+	{ "simulate", 0, &tracks_index },
+	{ "strike", 0, &stats_index },
+	{ "toggle", 0, &toggles_index },
+	{ "yesorno", 0, &yesorno_index },
+};
+
+/* Index and position of the names returned by the generator */
+static struct complete_index *current = NULL;
+static size_t next_match;
+
+static void
+add_name(struct complete_index *ix, const char *name)
+{
+	char **p;
+
+	if (ix->n == ix->size) {
+		ix->size = ix->size ? ix->size * 2 : 64;
+		if ((p = reallocarray(ix->names, ix->size, sizeof(*p))) == NULL)
+			log_errx(1, "reallocarray");
+		ix->names = p;
+	}
+	if ((ix->names[ix->n++] = strdup(name)) == NULL)
+		log_errx(1, "strdup");
+}
+
+static void
+fill_words(struct complete_index *ix)
+{
+	const char **w;
+
+	for (w = ix->words; *w != NULL; w++)
+		add_name(ix, *w);
+}
+
+static void
+fill_commands(struct complete_index *ix)
+{
+	const char *name;
+	size_t iter = 0;
+
+	while ((name = next_command_name(&iter)) != NULL)
+		add_name(ix, name);
+}
+
+static void
+fill_characters(struct complete_index *ix)
+{
+	const char *name;
+	void *iter = NULL;
+
+	while ((name = next_character_name(&iter)) != NULL)
+		add_name(ix, name);
+}
+
+static void
+fill_oracles(struct complete_index *ix)
+{
+	const char *name;
+	size_t iter = 0;
+
+	load_all_oracle_tables();
+	while ((name = next_oracle_table_name(&iter)) != NULL)
+		add_name(ix, name);
+}
+
+static void
+fill_macros(struct complete_index *ix)
+{
+	const char *name;
+	void *iter = NULL;
+
+	while ((name = next_macro_name(&iter)) != NULL)
+		add_name(ix, name);
+}
+
+static void
+fill_odds_moves(struct complete_index *ix)
+{
+	const char *name;
+	size_t iter = 0;
+
+	while ((name = next_odds_move_name(&iter)) != NULL)
+		add_name(ix, name);
+}
+
+static void
+fill_advise_moves(struct complete_index *ix)
+{
+	const char *name;
+	size_t iter = 0;
+
+	while ((name = next_advise_move_name(&iter)) != NULL)
+		add_name(ix, name);
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+	return strcasecmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+build_index(struct complete_index *ix)
+{
+	size_t i;
+
+	if (ix->valid)
+		return;
+
+	for (i = 0; i < ix->n; i++)
+		free(ix->names[i]);
+	ix->n = 0;
+
+	ix->fill(ix);
+	/* Set last, filling may load oracle tables, which are all in the index */
+	ix->valid = 1;
+	qsort(ix->names, ix->n, sizeof(*ix->names), compare_names);
+	log_debug("Built a completion index of %zu names\n", ix->n);
+}
+
+/* First name in the index that is not smaller than the prefix */
+static size_t
+lower_bound(const struct complete_index *ix, const char *prefix, size_t len)
+{
+	size_t lo = 0, hi = ix->n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncasecmp(ix->names[mid], prefix, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static char *
+index_generator(const char *text, int state)
+{
+	static size_t len;
+
+	if (!state) {
+		len = strlen(text);
+		next_match = lower_bound(current, text, len);
+	}
+
+	if (next_match < current->n &&
+	    strncasecmp(current->names[next_match], text, len) == 0)
+		return strdup(current->names[next_match++]);
+
+	return NULL;
+}
+
+static int
+compare_schema(const void *a, const void *b)
+{
+	const struct complete_schema *x = a, *y = b;
+	int ret;
+
+	if ((ret = strcasecmp(x->cmd, y->cmd)) != 0)
+		return ret;
+
+	return x->arg - y->arg;
+}
+
+/* An entry out of order would silently hide itself from bsearch() */
+static void
+check_schemas(void)
+{
+	static int checked = 0;
+	size_t i;
+
+	if (checked)
+		return;
+	checked = 1;
+
+	for (i = 1; i < sizeof(schemas) / sizeof(schemas[0]); i++)
+		if (compare_schema(&schemas[i - 1], &schemas[i]) >= 0)
+			log_errx(1, "Completion schema %s %d is out of order\n",
+				schemas[i].cmd, schemas[i].arg);
+}
+
+/* Index of the argument that starts at start, NULL if there is none */
+static struct complete_index *
+argument_index(int start)
+{
+	struct complete_schema key;
+	const struct complete_schema *s;
+	char cmd[MAX_CHAR_LEN];
+	const char *p = rl_line_buffer;
+	size_t len;
+	int arg = 0, i;
+
+	check_schemas();
+
+	while (*p == ' ')
+		p++;
+	len = strcspn(p, " ");
+	if (len == 0 || len >= sizeof(cmd))
+		return NULL;
+	memcpy(cmd, p, len);
+	cmd[len] = '\0';
+
+	/* Count the words between the command and the argument */
+	for (i = p - rl_line_buffer + len; i < start; i++)
+		if (rl_line_buffer[i] != ' ' && rl_line_buffer[i - 1] == ' ')
+			arg++;
+
+	key.cmd = cmd;
+	key.arg = arg;
+	s = bsearch(&key, schemas, sizeof(schemas) / sizeof(schemas[0]),
+		sizeof(schemas[0]), compare_schema);
+
+	return s != NULL ? s->index : NULL;
+}
+
+/* Called by readline for the word between start and end */
+char **
+my_completion(const char *text, int start, __attribute__((unused))int end)
+{
+	struct complete_index *ix;
+
+	if (start == 0 || strspn(rl_line_buffer, " ") == (size_t)start)
+		ix = &commands_index;
+	else if ((ix = argument_index(start)) == NULL)
+		return NULL;
+
+	/* Do not mix in file names, the index knows all valid arguments */
+	rl_attempted_completion_over = 1;
+	build_index(ix);
+	current = ix;
+
+	return rl_completion_matches(text, index_generator);
+}
+
+/* The names of a source changed, rebuild its index on the next completion */
+void
+completion_changed(enum complete_source source)
+{
+	switch (source) {
+	case COMPLETE_CHARACTERS:
+		characters_index.valid = 0;
+		break;
+	case COMPLETE_ORACLES:
+		oracles_index.valid = 0;
+		break;
+	case COMPLETE_MACROS:
+		macros_index.valid = 0;
+		break;
+	}
+}
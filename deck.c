@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Draw oracle entries without replacement.  A deck is a shuffled list of the
+ * entries of one table.  Every entry comes up once before the deck is
+ * shuffled again.  Only the seed of the shuffle and the number of drawn
+ * entries are saved with the character, the list is shuffled again from the
+ * seed when the character is loaded.
+ */
+
+#include <sys/queue.h>
+
+#include <json-c/json.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isscrolls.h"
+
+struct deck {
+	LIST_ENTRY(deck)		 entries;
+	char				*name;
+	const struct oracle_table	*t;
+	uint64_t			 seed;
+	uint32_t			 pos;
+	uint32_t			 n;
+	uint32_t			*perm;
+};
+
+static LIST_HEAD(, deck) decks = LIST_HEAD_INITIALIZER(decks);
+
+/* Fisher-Yates shuffle of all entries of the table */
+static void
+shuffle_deck(struct deck *d)
+{
+	struct dice_rng r;
+	uint32_t i, j, tmp;
+
+	if (d->n != d->t->nentries) {
+		d->n = d->t->nentries;
+		if ((d->perm = reallocarray(d->perm, d->n,
+		    sizeof(*d->perm))) == NULL)
+			log_errx(1, "reallocarray");
+	}
+
+	rng_seed(&r, d->seed);
+	for (i = 0; i < d->n; i++)
+		d->perm[i] = i;
+	for (i = d->n - 1; i > 0; i--) {
+		j = rng_below(&r, i + 1);
+		tmp = d->perm[i];
+		d->perm[i] = d->perm[j];
+		d->perm[j] = tmp;
+	}
+
+	if (d->pos > d->n)
+		d->pos = 0;
+}
+
+static uint64_t
+new_deck_seed(void)
+{
+	return rng_next(get_dice_rng());
+}
+
+static struct deck *
+find_deck(const char *name)
+{
+	struct deck *d;
+
+	LIST_FOREACH(d, &decks, entries) {
+		if (strcmp(d->name, name) == 0)
+			return d;
+	}
+
+	return NULL;
+}
+
+static struct deck *
+add_deck(const char *name, uint64_t seed, uint32_t pos)
+{
+	const struct oracle_table *t;
+	struct deck *d;
+
+	if ((t = lookup_oracle_table(name)) == NULL)
+		return NULL;
+
+	if ((d = calloc(1, sizeof(*d))) == NULL)
+		log_errx(1, "calloc");
+	if ((d->name = strdup(name)) == NULL)
+		log_errx(1, "strdup");
+	d->t = t;
+	d->seed = seed;
+	d->pos = pos;
+	shuffle_deck(d);
+	LIST_INSERT_HEAD(&decks, d, entries);
+
+	return d;
+}
+
+static void
+draw_from_deck(const char *name)
+{
+	struct deck *d;
+	uint32_t entry;
+
+	if ((d = find_deck(name)) == NULL &&
+	    (d = add_deck(name, new_deck_seed(), 0)) == NULL) {
+		printf("Unknown oracle table %s.  Press TAB to see all tables\n",
+			name);
+		return;
+	}
+
+	/* The table was reloaded with a different number of entries */
+	if (d->n != d->t->nentries)
+		shuffle_deck(d);
+
+	if (d->pos == d->n) {
+		/* The next seed follows from the old one, so replays match */
+		rng_splitmix(&d->seed);
+		d->pos = 0;
+		shuffle_deck(d);
+		printf("All entries of %s were drawn, shuffled the deck\n", d->name);
+	}
+
+	entry = d->perm[d->pos++];
+	oracle_expand(stdout, d->t, d->t->entries[entry].high);
+	printf(" [%u/%u]\n", d->pos, d->n);
+}
+
+static void
+reset_deck(const char *name)
+{
+	struct deck *d;
+
+	if ((d = find_deck(name)) == NULL) {
+		printf("There is no deck for %s\n", name);
+		return;
+	}
+
+	d->seed = new_deck_seed();
+	d->pos = 0;
+	shuffle_deck(d);
+	printf("Shuffled the deck of %s\n", d->name);
+}
+
+void
+cmd_draw_from_deck(char *args)
+{
+	struct deck *d;
+
+	if (args == NULL || strlen(args) == 0) {
+		if (LIST_EMPTY(&decks)) {
+			printf("Provide the name of an oracle table as argument\n\n");
+			printf("Example: deck names/ironlander\n");
+			return;
+		}
+		LIST_FOREACH(d, &decks, entries)
+			printf("%-40s %u of %u drawn\n", d->name, d->pos, d->n);
+		return;
+	}
+
+	if (strncmp(args, "reset ", 6) == 0)
+		reset_deck(args + 6);
+	else
+		draw_from_deck(args);
+}
+
+/* Add the decks of the current character to its JSON object */
+void
+save_decks(json_object *cobj)
+{
+	json_object *items, *dobj;
+	struct deck *d;
+
+	items = json_object_new_array();
+	LIST_FOREACH(d, &decks, entries) {
+		dobj = json_object_new_object();
+		json_object_object_add(dobj, "table",
+			json_object_new_string(d->name));
+		json_object_object_add(dobj, "seed",
+			json_object_new_int64((int64_t)d->seed));
+		json_object_object_add(dobj, "position",
+			json_object_new_int(d->pos));
+		json_object_array_add(items, dobj);
+	}
+
+	json_object_object_add(cobj, "decks", items);
+}
+
+void
+load_decks(json_object *cobj)
+{
+	json_object *items, *dobj, *name, *seed;
+	size_t n, i;
+
+	free_decks();
+
+	if (!json_object_object_get_ex(cobj, "decks", &items))
+		return;
+
+	n = json_object_array_length(items);
+	for (i = 0; i < n; i++) {
+		dobj = json_object_array_get_idx(items, i);
+		if (!json_object_object_get_ex(dobj, "table", &name) ||
+		    !json_object_object_get_ex(dobj, "seed", &seed))
+			continue;
+		if (add_deck(json_object_get_string(name),
+		    (uint64_t)json_object_get_int64(seed),
+		    validate_int(dobj, "position", 0, UINT16_MAX, 0)) == NULL)
+			log_debug("Dropping deck of unknown table %s\n",
+				json_object_get_string(name));
+	}
+}
+
+void
+free_decks()
+{
+	struct deck *d;
+
+	while ((d = LIST_FIRST(&decks)) != NULL) {
+		LIST_REMOVE(d, entries);
+		free(d->name);
+		free(d->perm);
+		free(d);
+	}
+}
@@ -477,6 +477,11 @@ delete_fight(int id)
 	size_t temp_n, i;
 	int ret;
 
+	if (saving_disabled()) {
+		log_debug("Saving is disabled, keeping the fight file\n");
+		return;
+	}
+
 	ret = snprintf(path, sizeof(path), "%s/fight.json", get_isscrolls_dir());
 	if (ret < 0 || (size_t)ret >= sizeof(path)) {
 		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Forecast how many more moves a journey, fight or delve needs until its
+ * progress move hits with a given chance.  The progress of a track is kept
+ * in quarter boxes, so there are only 41 states.  The expected number of
+ * moves from every state is computed backwards from the full track with the
+ * odds of the move that marks progress:
+ *
+ * E[t] = 0 once a progress roll at t hits with the target chance
+ * E[t] = (1 + p(strong) E[t + strong] + p(weak) E[t + weak]) / (1 - p(none))
+ *
+ * where p(none) is the chance of an outcome that marks no progress.  The
+ * result depends only on the marks per outcome, the stat and the target,
+ * so it is computed once for each combination and kept.
+ */
+
+#include <sys/param.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "isscrolls.h"
+
+#define FORECAST_TICKS		(MAX_PROGRESS * 4)
+#define FORECAST_CACHE		16
+#define FORECAST_TARGET		75
+
+struct forecast {
+	int	strong;		/* quarter boxes marked on a strong hit */
+	int	weak;		/* quarter boxes marked on a weak hit */
+	int	modifier;
+	int	target;		/* first score in quarter boxes that is good enough */
+	double	moves[FORECAST_TICKS + 1];
+};
+
+static struct forecast cache[FORECAST_CACHE];
+static int ncache = 0, next_slot = 0;
+static int in_prompt = 0;
+
+/* Quarter boxes marked by one mark of progress at a difficulty */
+static int
+ticks_per_mark(int difficulty)
+{
+	switch (difficulty) {
+	case 1:
+		return 12;
+	case 2:
+		return 8;
+	case 3:
+		return 4;
+	case 4:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/* First score in quarter boxes where a progress roll hits with pct percent */
+static int
+target_ticks(int pct)
+{
+	const struct odds *o;
+	int t;
+
+	for (t = 0; t < FORECAST_TICKS; t++) {
+		o = progress_odds(t / 4.0);
+		if (100 * (o->strong + o->weak) >= pct * o->total)
+			break;
+	}
+
+	return t;
+}
+
+static const struct forecast *
+solve(int strong, int weak, int modifier, int target)
+{
+	const struct odds *o = action_odds(modifier);
+	struct forecast *f;
+	double ps, pw, pnone;
+	int i, t;
+
+	for (i = 0; i < ncache; i++) {
+		f = &cache[i];
+		if (f->strong == strong && f->weak == weak &&
+		    f->modifier == modifier && f->target == target)
+			return f;
+	}
+
+	f = &cache[next_slot];
+	next_slot = (next_slot + 1) % FORECAST_CACHE;
+	if (ncache < FORECAST_CACHE)
+		ncache++;
+
+	f->strong = strong;
+	f->weak = weak;
+	f->modifier = modifier;
+	f->target = target;
+
+	ps = (double)o->strong / o->total;
+	pw = (double)o->weak / o->total;
+	pnone = (double)o->miss / o->total + (weak == 0 ? pw : 0);
+
+	for (t = FORECAST_TICKS; t >= 0; t--) {
+		if (t >= target) {
+			f->moves[t] = 0;
+			continue;
+		}
+		f->moves[t] = 1 + ps * f->moves[MIN(t + strong, FORECAST_TICKS)];
+		if (weak > 0)
+			f->moves[t] += pw * f->moves[MIN(t + weak, FORECAST_TICKS)];
+		f->moves[t] /= 1 - pnone;
+	}
+
+	return f;
+}
+
+/*
+ * Expected number of moves until the progress move of a track hits with
+ * pct percent, -1 if the track is not active
+ */
+static double
+forecast_moves(const struct character *c, enum forecast_track track, int pct,
+	const char **move)
+{
+	const struct forecast *f;
+	double progress = 0;
+	int mark, strong = 1, weak = 0, modifier = 0;
+
+	switch (track) {
+	case FORECAST_JOURNEY:
+		if (!c->journey_active)
+			return -1;
+		/* Undertake a journey marks progress on a strong and a weak hit */
+		mark = ticks_per_mark(c->j->difficulty);
+		strong = weak = mark;
+		modifier = c->wits;
+		progress = c->j->progress;
+		*move = "undertakeajourney";
+		break;
+	case FORECAST_FIGHT:
+		if (!c->fight_active)
+			return -1;
+		/* Strike marks two harm on a strong hit, one on a weak hit */
+		mark = ticks_per_mark(c->fight->difficulty);
+		strong = 2 * mark;
+		weak = mark;
+		if (c->weapon == 2) {
+			strong += mark;
+			weak += mark;
+		}
+		modifier = MAX(c->iron, c->edge);
+		progress = c->fight->progress;
+		*move = "strike";
+		break;
+	case FORECAST_DELVE:
+		if (!c->delve_active)
+			return -1;
+		/* Delve the depths only marks progress on a strong hit */
+		mark = ticks_per_mark(c->delve->difficulty);
+		strong = mark;
+		weak = 0;
+		modifier = MAX(c->wits, MAX(c->shadow, c->edge));
+		progress = c->delve->progress;
+		*move = "delvethedepths";
+		break;
+	}
+
+	f = solve(strong, weak, modifier, target_ticks(pct));
+
+	return f->moves[MIN((int)(progress * 4), FORECAST_TICKS)];
+}
+
+static void
+print_forecast(const struct character *c, enum forecast_track track, int pct)
+{
+	static const char *names[] = { "journey", "fight", "delve" };
+	static const char *progress_moves[] = {
+		"reachyourdestination", "endthefight", "locateyourobjective"
+	};
+	const struct odds *o;
+	const char *move = NULL;
+	double moves, progress = 0;
+
+	if ((moves = forecast_moves(c, track, pct, &move)) < 0) {
+		printf("No active %s\n", names[track]);
+		return;
+	}
+
+	switch (track) {
+	case FORECAST_JOURNEY:
+		progress = c->j->progress;
+		break;
+	case FORECAST_FIGHT:
+		progress = c->fight->progress;
+		break;
+	case FORECAST_DELVE:
+		progress = c->delve->progress;
+		break;
+	}
+
+	o = progress_odds(progress);
+	printf("%s at %.2f/10, %s hits %.0f%% now.  ", names[track], progress,
+		progress_moves[track], 100.0 * (o->strong + o->weak) / o->total);
+	if (moves == 0)
+		printf("Good to go for %d%%\n", pct);
+	else
+		printf("About %.1f more %s moves to reach %d%%\n", moves, move, pct);
+}
+
+/* Short forecast for the prompt, e.g. " ~3", empty if it is turned off */
+void
+forecast_prompt(char *buf, size_t len, enum forecast_track track)
+{
+	struct character *c = get_current_character();
+	const char *move;
+	double moves;
+
+	buf[0] = '\0';
+	if (!in_prompt || c == NULL)
+		return;
+
+	if ((moves = forecast_moves(c, track, FORECAST_TARGET, &move)) >= 0)
+		snprintf(buf, len, " ~%.0f", moves);
+}
+
+void
+cmd_forecast(char *cmd)
+{
+	struct character *curchar = get_current_character();
+	char *tokens[3] = { NULL };
+	char *p, *last, *ep;
+	enum forecast_track track = FORECAST_JOURNEY;
+	long pct = FORECAST_TARGET;
+	int i = 0, all = 1;
+
+	CURCHAR_CHECK();
+
+	for ((p = strtok_r(cmd, " ", &last)); p;
+	    (p = strtok_r(NULL, " ", &last))) {
+		if (i < 2)
+			tokens[i++] = p;
+	}
+
+	for (i = 0; tokens[i] != NULL; i++) {
+		if (strcasecmp(tokens[i], "prompt") == 0) {
+			in_prompt = !in_prompt;
+			printf("Forecast in the prompt turned %s\n",
+				in_prompt ? "on" : "off");
+			update_prompt();
+			return;
+		} else if (strcasecmp(tokens[i], "journey") == 0) {
+			track = FORECAST_JOURNEY;
+			all = 0;
+		} else if (strcasecmp(tokens[i], "fight") == 0) {
+			track = FORECAST_FIGHT;
+			all = 0;
+		} else if (strcasecmp(tokens[i], "delve") == 0) {
+			track = FORECAST_DELVE;
+			all = 0;
+		} else {
+			errno = 0;
+			pct = strtol(tokens[i], &ep, 10);
+			if (*ep != '\0' || errno == ERANGE || pct < 1 || pct > 99) {
+				printf("Please provide a chance between 1 and 99\n");
+				return;
+			}
+		}
+	}
+
+	if (!all) {
+		print_forecast(curchar, track, pct);
+		return;
+	}
+
+	if (!curchar->journey_active && !curchar->fight_active &&
+	    !curchar->delve_active) {
+		printf("There is no journey, fight or delve to forecast\n");
+		return;
+	}
+
+	if (curchar->journey_active)
+		print_forecast(curchar, FORECAST_JOURNEY, pct);
+	if (curchar->fight_active)
+		print_forecast(curchar, FORECAST_FIGHT, pct);
+	if (curchar->delve_active)
+		print_forecast(curchar, FORECAST_DELVE, pct);
+}
@@ -17,13 +17,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <errno.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 
 #include <readline/readline.h>
@@ -33,10 +33,17 @@
 
 static char prompt[MAX_PROMPT_LEN];
 static char isscrolls_dir[_POSIX_PATH_MAX];
+static char override_dir[_POSIX_PATH_MAX];
 
 static int debug = 0;
 static int color = 0;
 static int banner = 1;
+static int rflag = 0;
+static int wflag = 0;
+static int nosave = 0;
+static int history = 0;
+static int oneshot = 0;
+static char *progname = "isscrolls";
 
 static volatile sig_atomic_t sflag = 0;
 
@@ -73,16 +80,15 @@ show_banner(__attribute__((unused)) char *unused)
 int
 main(int argc, char **argv)
 {
-	char *line, *res;
-	int ch;
+	char *line, *res, *ep, *file = NULL, **cmds = NULL;
+	uint64_t seed, *seedp = NULL;
+	size_t ncmds = 0, i;
+	FILE *fp = NULL;
+	int ch, ret;
 
-	/*
-	 * Seed the PRNG with the current time of the day.  This is not fine
-	 * for a security critical application, for rolling dice it is
-	 */
-	srandom(time(NULL) ^ getpid());
+	progname = argv[0];
 
-	while ((ch = getopt(argc, argv, "cdb")) != -1) {
+	while ((ch = getopt(argc, argv, "cdbe:f:jkors:w")) != -1) {
 		switch (ch) {
 		case 'b':
 			banner = 0;
@@ -93,18 +99,107 @@ main(int argc, char **argv)
 		case 'd':
 			debug = 1;
 			break;
+		case 'e':
+			if ((cmds = reallocarray(cmds, ncmds + 1,
+			    sizeof(*cmds))) == NULL)
+				log_errx(1, "reallocarray");
+			cmds[ncmds++] = optarg;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'j':
+			use_json_oracles();
+			break;
+		case 'k':
+			set_dice_source(DICE_ENTROPY);
+			break;
+		case 'o':
+			show_roll_odds();
+			break;
+		case 'r':
+			rflag = 1;
+			break;
+		case 's':
+			errno = 0;
+			seed = strtoull(optarg, &ep, 10);
+			if (optarg[0] == '\0' || *ep != '\0' || errno == ERANGE)
+				log_errx(1, "Please provide a number as seed\n");
+			seedp = &seed;
+			break;
+		case 'w':
+			wflag = 1;
+			use_json_oracles();
+			break;
 		}
 	}
 
+	/* With a seed, the same commands give the same results every time */
+	init_dice_rng(seedp);
+	if (seedp != NULL && get_dice_source() == DICE_ENTROPY)
+		log_debug("The dice come from the kernel, the seed is not used\n");
+
 	argc -= optind;
 	argv += optind;
 
 	setup_base_dir();
 
-	initialize_readline(isscrolls_dir);
+	/* Own oracle files in the isscrolls directory replace the shipped ones */
+	ret = snprintf(override_dir, sizeof(override_dir), "%s/oracles",
+		isscrolls_dir);
+	if (ret < 0 || (size_t)ret >= sizeof(override_dir)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", override_dir);
+	}
+	set_oracle_override_dir(override_dir);
+
+	/* Bulk rolls with the remaining arguments, no interactive session */
+	if (rflag)
+		exit(bulk_roll(argc, argv));
+
+	/* A lone - reads the commands from stdin like -f - */
+	if (file == NULL && argc > 0 && strcmp(argv[0], "-") == 0)
+		file = argv[0];
+
+	if (ncmds > 0 && file != NULL)
+		log_errx(1, "Please use either -e or -f, not both\n");
+
+	/*
+	 * One-shot commands, only load the characters if a command needs them
+	 * and save the current one only if it changed
+	 */
+	if (ncmds > 0) {
+		if ((ret = commands_need_character(cmds, ncmds)) == -1)
+			exit(1);
+		oneshot = 1;
+		sandbox(isscrolls_dir);
+		if (ret == 1 && load_characters_list() != -1)
+			snapshot_character();
+		for (i = 0; i < ncmds; i++) {
+			if ((line = strdup(cmds[i])) == NULL)
+				log_errx(1, "strdup");
+			res = stripwhite(line);
+			if (*res)
+				execute_command(res);
+			free(line);
+		}
+		free(cmds);
+		shutdown(0);
+	}
+
+	/* Batch mode, neither readline and its history nor a banner */
+	if (file != NULL) {
+		if (strcmp(file, "-") == 0)
+			fp = stdin;
+		else if ((fp = fopen(file, "r")) == NULL)
+			log_errx(1, "Cannot open %s: %s\n", file, strerror(errno));
+		set_batch_input(fp);
+	} else {
+		initialize_readline(isscrolls_dir);
+		history = 1;
 
-	if (banner)
-		show_banner(NULL);
+		if (banner)
+			show_banner(NULL);
+	}
 
 	if (signal(SIGINT, signal_handler) == SIG_ERR)
 		log_errx(1, "signal");
@@ -116,14 +211,24 @@ main(int argc, char **argv)
 	if (load_characters_list() == -1)
 		set_prompt("> ");
 
+	if (wflag)
+		init_oracle_watch();
+
 	while (!sflag) {
-		line = readline(prompt);
-		if (line == NULL)
+		line = read_input(prompt);
+		if (line == NULL) {
+			/* The end of a batch, readline returns NULL for ^D */
+			if (batch_mode())
+				break;
 			continue;
+		}
 		res = stripwhite(line);
 
-		if (*res) {
-			add_history(res);
+		/* Scripts can have comments */
+		if (*res && !(batch_mode() && *res == '#')) {
+			if (history)
+				add_history(res);
+			check_oracle_watch();
 			execute_command(res);
 		}
 
@@ -158,7 +263,7 @@ sandbox(const char *dir)
 	if (unveil(NULL, NULL) == -1)
 		log_errx(1, "unveil");
 
-	if (pledge("stdio rpath wpath cpath tty", NULL) == -1)
+	if (pledge("stdio rpath wpath cpath flock tty proc", NULL) == -1)
 		log_errx(1, "pledge");
 }
 #else
@@ -177,17 +282,28 @@ void
 shutdown(int exit_code)
 {
 	char hist_path[_POSIX_PATH_MAX];
+	size_t ntables, nbytes;
 	int ret;
 
-	save_current_character();
+	if (!oneshot || character_changed())
+		save_current_character();
+	close_audit();
+
+	/* Lazy loading pays off if only a few tables were needed */
+	get_oracle_resident(&ntables, &nbytes);
+	log_debug("%zu oracle tables with %zu bytes were resident\n", ntables,
+		nbytes);
 
 	ret = snprintf(hist_path, sizeof(hist_path), "%s/history", isscrolls_dir);
 	if (ret < 0 || (size_t)ret >= sizeof(hist_path)) {
 		printf("Path truncation happended.  Buffer to short to fit %s\n", hist_path);
 	}
 
-	log_debug("Writing history to %s\n", hist_path);
-	write_history(hist_path);
+	/* Without readline, there is no history to write */
+	if (history) {
+		log_debug("Writing history to %s\n", hist_path);
+		write_history(hist_path);
+	}
 
 	exit(exit_code);
 }
@@ -282,3 +398,23 @@ get_isscrolls_dir()
 {
 	return isscrolls_dir;
 }
+
+/* Name the program was started with, e.g. to start it again */
+char *
+get_program_path()
+{
+	return progname;
+}
+
+/* Keep all changes in memory, e.g. in the workers of a simulation */
+void
+disable_saving()
+{
+	nosave = 1;
+}
+
+int
+saving_disabled()
+{
+	return nosave;
+}
@@ -18,30 +18,28 @@
 #define ISSCROLLS_H
 
 #include <sys/queue.h>
+#include <sys/types.h>
 
 #include <json-c/json.h>
 
+#include <stdint.h>
 #include <stdio.h>
 
 #define VERSION "2021.d"
 #define PATH_SHARE_DIR "/usr/local/share/isscrolls"
 
-#define MAX_NAME_LEN 12
-#define MAX_RANK_LEN 13
-#define MAX_PLOT_LEN 63
-#define MAX_MYSTIC_LEN 127
-#define MAX_PLACES_LEN 18
 #define MAX_PROMPT_LEN 255
-#define MAX_PTP_LEN 201
 #define MAX_CHAR_LEN 100
 #define MAX_PROGRESS 10
 #define MAX_STAT_LEN 20
-#define MAX_DELVE_LEN 50
-#define MAX_ROLE_LEN 14
-#define MAX_GOAL_LEN 26
-#define MAX_DESC_LEN 26
-#define MAX_DISP_LEN 26
-#define MAX_ACTIVITY_LEN 26
+
+/* Largest stat plus bonus and progress score with their own odds */
+#define ODDS_MAX_MODIFIER 20
+#define ODDS_MAX_PROGRESS 11
+#define ODDS_PROGRESS_TICKS (ODDS_MAX_PROGRESS * 4)
+#define ODDS_MIN_MOMENTUM -6
+#define ODDS_MAX_MOMENTUM 10
+#define ODDS_MOMENTUM_VALUES (ODDS_MAX_MOMENTUM - ODDS_MIN_MOMENTUM + 1)
 
 #define STAT_WITS 	0x00001
 #define STAT_EDGE 	0x00010
@@ -65,6 +63,37 @@
 	} 																\
 } while(0)
 
+struct oracle_entry;
+struct oracle_source;
+struct oracle_prog;
+struct oracle_table;
+struct dice_rng;
+struct dice_batch;
+struct odds;
+
+enum complete_source {
+	COMPLETE_CHARACTERS,
+	COMPLETE_ORACLES,
+	COMPLETE_MACROS,
+};
+
+enum dice_source {
+	DICE_PRNG,
+	DICE_ENTROPY,
+};
+
+enum batch_impl {
+	BATCH_PORTABLE,
+	BATCH_SSE2,
+	BATCH_AVX2,
+};
+
+enum forecast_track {
+	FORECAST_JOURNEY,
+	FORECAST_FIGHT,
+	FORECAST_DELVE,
+};
+
 /* oracle.c */
 void cmd_show_iron_name(char *);
 void cmd_show_elf_name(char *);
@@ -85,14 +114,137 @@ void cmd_show_pay_the_price(char *);
 void cmd_reveal_a_danger(char *);
 void cmd_find_an_opportunity(char *);
 void cmd_generate_npc(char *);
-void show_info_from_oracle(int, int, int);
+void cmd_roll_oracle_table(char *);
+long oracle_dice(int, const struct oracle_table *);
+void show_info_from_oracle(int, int);
+struct oracle_prog * compile_oracle_table(const struct oracle_table *);
+void reset_oracle_prog(struct oracle_prog *);
+void free_oracle_prog(struct oracle_prog *);
+void oracle_expand(FILE *, const struct oracle_table *, long);
+const char * oracle_plain(const struct oracle_table *, long);
 void convert_to_lowercase(char *);
 
-/* readline.c */
+/* tables.c */
+size_t oracle_array_count(void);
+const char * oracle_array_name(size_t);
+int oracle_array_rows(size_t);
+const char * oracle_array_row(size_t, int);
+size_t oracle_array_row_len(size_t, int);
+void free_oracle_arrays(void);
+int build_oracle_index(const struct oracle_entry *, uint32_t, uint16_t *, uint32_t);
+int read_oracle_file(struct oracle_source *);
+int check_oracle_file(struct oracle_source *,
+	const struct oracle_table *(*)(const char *), char *, size_t);
+void normalize_name(const char *, const char *, char *, size_t);
+struct oracle_source * get_oracle_sources(size_t *);
+struct oracle_source * find_oracle_source(const char *);
+struct oracle_source * new_oracle_source(const char *, const char *);
+const char * oracle_path(int);
+const char * get_oracle_dir(void);
+void set_oracle_dir(const char *);
+const char * get_oracle_override_dir(void);
+void set_oracle_override_dir(const char *);
+
+/* cache.c */
+void use_json_oracles(void);
+void get_oracle_resident(size_t *, size_t *);
+void load_all_oracle_tables(void);
+int reload_oracle_source(struct oracle_source *);
+const struct oracle_table * lookup_oracle_table(const char *);
+int has_oracle_table(const char *);
+const struct oracle_table * get_oracle_table(int);
+const char * next_oracle_table_name(size_t *);
+
+/* rng.c */
+uint64_t rng_splitmix(uint64_t *);
+void rng_seed(struct dice_rng *, uint64_t);
+void rng_restore(struct dice_rng *, uint64_t, uint64_t);
+int rng_set_state(struct dice_rng *, uint64_t, uint64_t, const uint64_t *);
+uint64_t rng_next(struct dice_rng *);
+uint32_t rng_below(struct dice_rng *, uint32_t);
+void init_dice_rng(const uint64_t *);
+struct dice_rng * get_dice_rng(void);
+void set_dice_rng(struct dice_rng *);
+uint32_t dice_below(uint32_t);
+void set_dice_source(enum dice_source);
+enum dice_source get_dice_source(void);
+void set_entropy_chunk(size_t);
+
+/* odds.c */
+const struct odds * action_odds(int);
+const struct odds * progress_odds(double);
+const struct momentum_odds * momentum_odds(int, int);
+void show_roll_odds(void);
+void print_roll_odds(const struct odds *);
+void cmd_show_odds(char *);
+const char * next_odds_move_name(size_t *);
+
+/* forecast.c */
+void forecast_prompt(char *, size_t, enum forecast_track);
+void cmd_forecast(char *);
+
+/* complete.c */
 char ** my_completion(const char *, int, int);
-char* command_generator(const char *, int);
+void completion_changed(enum complete_source);
+
+/* advise.c */
+void cmd_advise(char *);
+const char * next_advise_move_name(size_t *);
+
+/* macro.c */
+void load_macros(void);
+int is_macro_definition(const char *);
+const char * next_macro_name(void **);
+void cmd_macro(char *);
+
+/* simulate.c */
+void cmd_simulate(char *);
+
+/* batch.c */
+const char * batch_impl_name(enum batch_impl);
+int batch_set_impl(enum batch_impl);
+enum batch_impl batch_get_impl(void);
+void batch_seed(struct dice_batch *, struct dice_rng *);
+void batch_dice(struct dice_batch *, uint8_t *, size_t, uint32_t);
+void batch_classify(const uint8_t *, const uint8_t *, const uint8_t *, size_t,
+	int, uint8_t *, uint64_t[3]);
+
+/* bench.c */
+void cmd_benchmark(char *);
+
+/* audit.c */
+void audit_roll(long, long);
+void set_audit_move(const char *);
+void flush_audit(void);
+void pause_audit(int);
+void close_audit(void);
+void cmd_audit(char *);
+
+/* deck.c */
+void cmd_draw_from_deck(char *);
+void save_decks(json_object *);
+void load_decks(json_object *);
+void free_decks(void);
+
+/* watch.c */
+void init_oracle_watch(void);
+void check_oracle_watch(void);
+
+/* bulk.c */
+void cmd_roll_bulk(char *);
+int bulk_roll(int, char **);
+
+/* readline.c */
+struct command;
+const char * next_command_name(size_t *);
+int commands_need_character(char **, size_t);
+char * read_input(const char *);
+void set_batch_input(FILE *);
+int batch_mode(void);
 void initialize_readline(const char *);
 void execute_command(char *);
+void dispatch_command(struct command *, char *);
+void cmd_replay(char *);
 char* stripwhite (char *);
 struct command* find_command(char *);
 void cmd_cd(char *);
@@ -121,9 +273,11 @@ void cmd_write_your_epilogue(char *);
 long roll_action_die(void);
 long roll_challenge_die(void);
 long roll_oracle_die(void);
+long roll_die(long);
 void yes_or_no(int);
 int action_roll(int[2]);
 int progress_roll(double[2]);
+int get_last_roll(void);
 void ask_for_journey_difficulty(void);
 int get_int_from_cmd(const char *);
 int get_args_from_cmd(char *, char *, int*);
@@ -139,6 +293,9 @@ void shutdown(int) __attribute__((noreturn));
 void sandbox(const char *);
 void set_prompt(const char *);
 const char * get_isscrolls_dir(void);
+char * get_program_path(void);
+void disable_saving(void);
+int saving_disabled(void);
 
 /* character.c */
 struct character* init_character_struct(void);
@@ -153,6 +310,8 @@ void save_character(void);
 void delete_saved_character(int);
 int load_character(int) __attribute((warn_unused_result));
 struct character * get_current_character(void);
+void set_current_character(struct character *);
+void set_next_answer(int);
 int return_character_id(const char *) __attribute((warn_unused_result));
 int return_char_stat(const char *, int) __attribute((warn_unused_result));
 int load_characters_list(void)  __attribute((warn_unused_result));
@@ -175,6 +334,9 @@ void set_max_momentum(void);
 int validate_int(json_object *, const char *, int, int, int);
 double validate_double(json_object *, const char *, double, double, double);
 int character_exists(const char *) __attribute((warn_unused_result));
+const char * next_character_name(void **);
+void snapshot_character(void);
+int character_changed(void);
 void update_prompt(void);
 void unset_last_loaded_character(void);
 
@@ -241,6 +403,7 @@ enum oracle_codes {
 	ORACLE_CHAR_DESC ,
 	ORACLE_CHAR_DISPOSITION ,
 	ORACLE_CHAR_ACTIVITY,
+	ORACLE_MAX,
 };
 
 enum how_to_change_values {
@@ -255,11 +418,47 @@ enum color_codes {
 	DEFAULT,
 };
 
+struct oracle_source {
+	const char	*dir;
+	char		*file;
+	char		 prefix[64];
+	int		 loaded;
+	time_t		 mtime;		/* of the file when it was loaded */
+	unsigned char	*base;		/* cache mapping or buffer */
+	size_t		 size;
+	int		 mapped;
+};
+
+/* An entry covers the rolls from low to high, str is its offset in strings */
+struct oracle_entry {
+	uint32_t	str;
+	uint16_t	low;
+	uint16_t	high;
+};
+
+/*
+ * index maps every roll from 1 to dice straight to the entry covering it,
+ * so looking up a roll is a single load.
+ */
+struct oracle_table {
+	const char			*name;
+	uint32_t			 nentries;
+	uint32_t			 dice;
+	const struct oracle_entry	*entries;
+	const uint16_t			*index;
+	const char			*strings;
+	struct oracle_prog		*prog;
+};
+
+/* builtin.c, generated by mkoracles */
+extern const struct oracle_table builtin_tables[];
+
 struct command {
 	const char *name;
 	void (*cmd)(char *);
 	const char *doc;
 	int alias;
+	int nochar;	/* needs neither the current character nor the list */
 };
 
 struct journey {
@@ -275,6 +474,41 @@ struct fight {
 	int initiative;
 };
 
+/* Outcomes of all dice combinations of an action or progress roll */
+struct odds {
+	int total;
+	int strong;
+	int weak;
+	int miss;
+	int match;
+	int strong_match;
+	int miss_match;
+};
+
+/* Action roll at a momentum, which cancels the d6 if it is negative */
+struct momentum_odds {
+	struct odds roll;	/* without burning momentum */
+	struct odds burn;	/* burning momentum whenever it helps */
+	int upgrades;		/* dice where burning gives a better outcome */
+};
+
+/* Generated by mkodds, indexed by modifier and progress score in quarters */
+extern const struct odds action_table[];
+extern const struct odds progress_table[];
+extern const struct momentum_odds momentum_table[];
+
+/* State of the xoshiro256** generator behind all dice */
+struct dice_rng {
+	uint64_t s[4];
+	uint64_t seed;
+	uint64_t pos;	/* numbers produced since seeding */
+};
+
+/* Four xoshiro256** generators side by side for batches of dice */
+struct dice_batch {
+	uint64_t s[4][4];	/* s[word][generator] */
+};
+
 struct delve {
 	double progress;
 	int id;
@@ -285,6 +519,7 @@ struct character {
 	struct journey *j;
 	struct fight *fight;
 	struct delve *delve;
+	struct dice_rng dice;
 	char *name;
 	double bonds;
 	int dead;
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * User macros, named sequences of commands separated by ;.  A macro is
+ * compiled when it is defined or loaded: every command is looked up once and
+ * its arguments are split into literal text and placeholders, $1 to $9 for
+ * the arguments of the run and $* for all of them.  Running a macro only
+ * fills in the placeholders and calls the commands.
+ *
+ * The macros are saved to the file macros in the isscrolls directory, one
+ * per line with the name followed by the body as it was defined.
+ */
+
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "isscrolls.h"
+
+#define MACRO_FILE	"macros"
+#define MACRO_NAME_LEN	32
+#define MACRO_LINE_LEN	1024
+#define MACRO_MAX_ARGS	9
+#define MACRO_DEPTH	8
+
+struct macro_part {
+	char	*text;		/* literal, NULL for a placeholder */
+	int	 arg;		/* 1 to 9, 0 for all arguments */
+};
+
+struct macro_step {
+	struct command		*cmd;
+	struct macro_part	*parts;
+	size_t			 nparts;
+};
+
+struct macro {
+	TAILQ_ENTRY(macro)	 entry;
+	char			 name[MACRO_NAME_LEN];
+	char			*body;		/* as defined */
+	struct macro_step	*steps;
+	size_t			 nsteps;
+	int			 nargs;		/* highest placeholder */
+};
+
+static TAILQ_HEAD(macrohead, macro) macros = TAILQ_HEAD_INITIALIZER(macros);
+static int loaded = 0;
+static int depth = 0;
+
+/* Cut the next word off p, NULL if there is none */
+static char *
+next_word(char **p)
+{
+	char *word;
+
+	*p += strspn(*p, " \t");
+	if (**p == '\0')
+		return NULL;
+
+	word = *p;
+	*p += strcspn(*p, " \t");
+	if (**p != '\0')
+		*(*p)++ = '\0';
+	*p += strspn(*p, " \t");
+
+	return word;
+}
+
+static void
+add_part(struct macro_step *s, const char *text, size_t len, int arg)
+{
+	struct macro_part *p;
+
+	if ((p = reallocarray(s->parts, s->nparts + 1, sizeof(*p))) == NULL)
+		log_errx(1, "reallocarray");
+	s->parts = p;
+	p = &s->parts[s->nparts++];
+	p->text = NULL;
+	p->arg = arg;
+	if (text != NULL && (p->text = strndup(text, len)) == NULL)
+		log_errx(1, "strndup");
+}
+
+static void
+free_macro(struct macro *m)
+{
+	size_t i, j;
+
+	for (i = 0; i < m->nsteps; i++) {
+		for (j = 0; j < m->steps[i].nparts; j++)
+			free(m->steps[i].parts[j].text);
+		free(m->steps[i].parts);
+	}
+	free(m->steps);
+	free(m->body);
+	free(m);
+}
+
+/* Split the arguments of a step into literal text and placeholders */
+static void
+compile_args(struct macro *m, struct macro_step *s, const char *args)
+{
+	const char *p, *lit;
+
+	for (p = lit = args; *p != '\0'; p++) {
+		if (p[0] != '$' || (p[1] != '*' && (p[1] < '1' || p[1] > '9')))
+			continue;
+		if (p > lit)
+			add_part(s, lit, p - lit, 0);
+		if (p[1] == '*')
+			add_part(s, NULL, 0, 0);
+		else {
+			add_part(s, NULL, 0, p[1] - '0');
+			m->nargs = MAX(m->nargs, p[1] - '0');
+		}
+		lit = ++p + 1;
+	}
+	if (p > lit)
+		add_part(s, lit, p - lit, 0);
+}
+
+/* Compile a body into a macro, NULL if a command is unknown */
+static struct macro *
+compile_macro(const char *name, const char *body)
+{
+	struct macro *m;
+	struct macro_step *s;
+	char *copy, *rest, *cmd, *word;
+
+	if ((m = calloc(1, sizeof(*m))) == NULL)
+		log_errx(1, "calloc");
+	snprintf(m->name, sizeof(m->name), "%s", name);
+	if ((m->body = strdup(body)) == NULL || (copy = strdup(body)) == NULL)
+		log_errx(1, "strdup");
+
+	rest = copy;
+	while ((cmd = strsep(&rest, ";")) != NULL) {
+		if ((word = next_word(&cmd)) == NULL)
+			continue;
+
+		if ((s = reallocarray(m->steps, m->nsteps + 1,
+		    sizeof(*s))) == NULL)
+			log_errx(1, "reallocarray");
+		m->steps = s;
+		s = &m->steps[m->nsteps++];
+		memset(s, 0, sizeof(*s));
+
+		if ((s->cmd = find_command(word)) == NULL || s->cmd->cmd == NULL) {
+			printf("Unknown command %s in macro %s\n", word, name);
+			free(copy);
+			free_macro(m);
+			return NULL;
+		}
+		compile_args(m, s, stripwhite(cmd));
+	}
+	free(copy);
+
+	if (m->nsteps == 0) {
+		printf("Macro %s has no commands\n", name);
+		free_macro(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+static struct macro *
+find_macro(const char *name)
+{
+	struct macro *m;
+
+	TAILQ_FOREACH(m, &macros, entry)
+		if (strcasecmp(m->name, name) == 0)
+			return m;
+
+	return NULL;
+}
+
+/* Add a macro, it replaces one of the same name */
+static void
+insert_macro(struct macro *m)
+{
+	struct macro *old;
+
+	if ((old = find_macro(m->name)) != NULL) {
+		TAILQ_INSERT_AFTER(&macros, old, m, entry);
+		TAILQ_REMOVE(&macros, old, entry);
+		free_macro(old);
+	} else
+		TAILQ_INSERT_TAIL(&macros, m, entry);
+	completion_changed(COMPLETE_MACROS);
+}
+
+static int
+valid_name(const char *name)
+{
+	const char *p;
+
+	if (strlen(name) >= MACRO_NAME_LEN)
+		return 0;
+	for (p = name; *p != '\0'; p++)
+		if (!isalnum((unsigned char)*p) && *p != '-' && *p != '_')
+			return 0;
+
+	return 1;
+}
+
+static void
+macro_path(char *path, size_t len)
+{
+	int ret;
+
+	ret = snprintf(path, len, "%s/%s", get_isscrolls_dir(), MACRO_FILE);
+	if (ret < 0 || (size_t)ret >= len) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
+	}
+}
+
+void
+load_macros()
+{
+	char path[_POSIX_PATH_MAX];
+	char *line = NULL, *p, *name;
+	struct macro *m;
+	size_t size = 0;
+	FILE *fp;
+
+	if (loaded)
+		return;
+	loaded = 1;
+
+	macro_path(path, sizeof(path));
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+
+	while (getline(&line, &size, fp) != -1) {
+		p = stripwhite(line);
+		if (*p == '\0' || *p == '#')
+			continue;
+		if ((name = next_word(&p)) == NULL || !valid_name(name) ||
+		    (m = compile_macro(name, p)) == NULL) {
+			log_debug("Ignoring a macro in %s\n", path);
+			continue;
+		}
+		insert_macro(m);
+	}
+	free(line);
+	fclose(fp);
+}
+
+static void
+save_macros(void)
+{
+	char path[_POSIX_PATH_MAX], tmp[_POSIX_PATH_MAX];
+	struct macro *m;
+	FILE *fp;
+	int ret;
+
+	if (saving_disabled()) {
+		log_debug("Saving is disabled\n");
+		return;
+	}
+
+	macro_path(path, sizeof(path));
+	ret = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if (ret < 0 || (size_t)ret >= sizeof(tmp)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", tmp);
+	}
+
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		printf("Cannot save the macros: %s\n", strerror(errno));
+		return;
+	}
+	TAILQ_FOREACH(m, &macros, entry)
+		fprintf(fp, "%s %s\n", m->name, m->body);
+	if (fclose(fp) == EOF || rename(tmp, path) == -1)
+		printf("Cannot save the macros: %s\n", strerror(errno));
+}
+
+/* Fill in the placeholders of every step and run it */
+static void
+run_macro(struct macro *m, char *args)
+{
+	char line[MACRO_LINE_LEN], all[MACRO_LINE_LEN];
+	char *argv[MACRO_MAX_ARGS], *p = args;
+	const struct macro_step *s;
+	const struct macro_part *part;
+	const char *text;
+	size_t i, j, len;
+	int argc = 0, ret;
+
+	snprintf(all, sizeof(all), "%s", args);
+	while (argc < MACRO_MAX_ARGS && (argv[argc] = next_word(&p)) != NULL)
+		argc++;
+	if (argc < m->nargs) {
+		printf("Macro %s needs %d argument%s\n", m->name, m->nargs,
+			m->nargs == 1 ? "" : "s");
+		return;
+	}
+
+	if (depth >= MACRO_DEPTH) {
+		printf("Macros nest deeper than %d\n", MACRO_DEPTH);
+		return;
+	}
+	depth++;
+
+	for (i = 0; i < m->nsteps; i++) {
+		s = &m->steps[i];
+		for (j = 0, len = 0, line[0] = '\0'; j < s->nparts; j++) {
+			part = &s->parts[j];
+			if (part->text != NULL)
+				text = part->text;
+			else
+				text = part->arg == 0 ? all : argv[part->arg - 1];
+			ret = snprintf(line + len, sizeof(line) - len, "%s", text);
+			if (ret < 0 || (size_t)ret >= sizeof(line) - len) {
+				len = sizeof(line);
+				break;
+			}
+			len += ret;
+		}
+		if (len >= sizeof(line)) {
+			printf("The arguments of %s are too long\n", s->cmd->name);
+			break;
+		}
+		dispatch_command(s->cmd, line);
+	}
+
+	depth--;
+}
+
+/* Whether the line defines a macro, which keeps the ; of its body */
+int
+is_macro_definition(const char *line)
+{
+	size_t len;
+
+	line += strspn(line, " \t");
+	len = strcspn(line, " \t");
+	if (len != strlen("macro") || strncasecmp(line, "macro", len) != 0)
+		return 0;
+
+	line += len;
+	line += strspn(line, " \t");
+	len = strcspn(line, " \t");
+
+	return len == strlen("define") && strncasecmp(line, "define", len) == 0;
+}
+
+/* Names of all macros, iter starts at NULL */
+const char *
+next_macro_name(void **iter)
+{
+	struct macro *m = *iter;
+
+	load_macros();
+	m = (m == NULL) ? TAILQ_FIRST(&macros) : TAILQ_NEXT(m, entry);
+	*iter = m;
+
+	return m != NULL ? m->name : NULL;
+}
+
+static void
+macro_usage(void)
+{
+	printf("Please provide a subcommand\n\n");
+	printf("> macro define <name> <commands>\t- Define or replace a macro\n");
+	printf("> macro run <name> [arguments]\t- Run a macro\n");
+	printf("> macro list\t\t\t\t- List all macros\n");
+	printf("> macro delete <name>\t\t\t- Delete a macro\n\n");
+	printf("Commands are separated by ; and $1 to $9 are replaced by the\n");
+	printf("arguments of the run, $* by all of them\n\n");
+	printf("Example: macro define hit strike $1; markprogress; p\n");
+	printf("         macro run hit iron\n");
+}
+
+void
+cmd_macro(char *cmd)
+{
+	struct macro *m;
+	char *p = cmd, *sub, *name;
+
+	load_macros();
+
+	if ((sub = next_word(&p)) == NULL) {
+		macro_usage();
+		return;
+	}
+
+	if (strcasecmp(sub, "list") == 0) {
+		if (TAILQ_EMPTY(&macros))
+			printf("No macros defined yet\n");
+		TAILQ_FOREACH(m, &macros, entry)
+			printf("%-16s %s\n", m->name, m->body);
+		return;
+	}
+
+	if ((name = next_word(&p)) == NULL) {
+		macro_usage();
+		return;
+	}
+
+	/* A running macro must not go away under it */
+	if (depth > 0 && strcasecmp(sub, "run") != 0) {
+		printf("Macros cannot be changed by a macro\n");
+		return;
+	}
+
+	if (strcasecmp(sub, "define") == 0) {
+		if (!valid_name(name)) {
+			printf("Macro names are letters, digits, - and _, up to "
+				"%d characters\n", MACRO_NAME_LEN - 1);
+			return;
+		}
+		if ((m = compile_macro(name, p)) == NULL)
+			return;
+		insert_macro(m);
+		save_macros();
+		printf("Defined macro %s with %zu command%s\n", m->name,
+			m->nsteps, m->nsteps == 1 ? "" : "s");
+	} else if (strcasecmp(sub, "run") == 0) {
+		if ((m = find_macro(name)) == NULL) {
+			printf("Unknown macro %s\n", name);
+			return;
+		}
+		run_macro(m, p);
+	} else if (strcasecmp(sub, "delete") == 0) {
+		if ((m = find_macro(name)) == NULL) {
+			printf("Unknown macro %s\n", name);
+			return;
+		}
+		TAILQ_REMOVE(&macros, m, entry);
+		free_macro(m);
+		completion_changed(COMPLETE_MACROS);
+		save_macros();
+		printf("Deleted macro %s\n", name);
+	} else
+		macro_usage();
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Build helper that writes the odds of every action roll modifier and every
+ * progress score in quarter boxes as const C tables to stdout.  The tables
+ * are computed from the number of challenge die faces a score beats and then
+ * checked against a brute force enumeration of all dice, which follows the
+ * comparisons of action_roll() and progress_roll().  A mismatch fails the
+ * build.
+ *
+ * The odds of an action roll at every momentum are enumerated, as burning
+ * momentum is a choice made after the dice are seen.  Positive momentum
+ * cancels the challenge dice below it, negative momentum cancels an action
+ * die of the same value.  Without a burn, they have to match the plain odds
+ * at positive momentum.
+ *
+ * Usage: mkodds > oddstables.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isscrolls.h"
+
+/* Add the outcomes of a whole number score against both challenge dice */
+static void
+add_score(struct odds *o, int score)
+{
+	int beaten;
+
+	/* Faces of one challenge die below the score */
+	beaten = score < 1 ? 0 : score > 11 ? 10 : score - 1;
+
+	o->total += 100;
+	o->strong += beaten * beaten;
+	o->miss += (10 - beaten) * (10 - beaten);
+	o->weak += 2 * beaten * (10 - beaten);
+	o->match += 10;
+	o->strong_match += beaten;
+	o->miss_match += 10 - beaten;
+}
+
+static void
+enumerate(struct odds *o, double score, int c1, int c2)
+{
+	o->total++;
+	if (score <= c1 && score <= c2) {
+		o->miss++;
+		if (c1 == c2)
+			o->miss_match++;
+	} else if (score <= c1 || score <= c2) {
+		o->weak++;
+	} else {
+		o->strong++;
+		if (c1 == c2)
+			o->strong_match++;
+	}
+	if (c1 == c2)
+		o->match++;
+}
+
+/* 2 for a strong hit, 1 for a weak hit, 0 for a miss */
+static int
+hits(int score, int c1, int c2, int momentum)
+{
+	return (score > c1 || c1 < momentum) + (score > c2 || c2 < momentum);
+}
+
+static void
+count_hits(struct odds *o, int h, int c1, int c2)
+{
+	o->total++;
+	if (h == 2)
+		o->strong++;
+	else if (h == 1)
+		o->weak++;
+	else
+		o->miss++;
+	if (c1 == c2) {
+		o->match++;
+		if (h == 2)
+			o->strong_match++;
+		else if (h == 0)
+			o->miss_match++;
+	}
+}
+
+static void
+enumerate_momentum(struct momentum_odds *mo, int m, int momentum)
+{
+	int a, c1, c2, score, plain, burnt;
+
+	for (a = 1; a <= 6; a++) {
+		score = (momentum < 0 && a == -momentum) ? m : a + m;
+		for (c1 = 1; c1 <= 10; c1++) {
+			for (c2 = 1; c2 <= 10; c2++) {
+				plain = hits(score, c1, c2, 0);
+				burnt = hits(score, c1, c2, momentum);
+				count_hits(&mo->roll, plain, c1, c2);
+				count_hits(&mo->burn, burnt, c1, c2);
+				if (burnt > plain)
+					mo->upgrades++;
+			}
+		}
+	}
+}
+
+static void
+verify(const char *what, double score, const struct odds *a,
+	const struct odds *b)
+{
+	if (memcmp(a, b, sizeof(*a)) == 0)
+		return;
+
+	fprintf(stderr, "mkodds: %s %.2f: %d/%d/%d/%d instead of %d/%d/%d/%d\n",
+		what, score, a->strong, a->weak, a->miss, a->match, b->strong,
+		b->weak, b->miss, b->match);
+	exit(1);
+}
+
+static void
+emit_odds(const struct odds *o)
+{
+	printf("{ %d, %d, %d, %d, %d, %d, %d }", o->total, o->strong, o->weak,
+		o->miss, o->match, o->strong_match, o->miss_match);
+}
+
+static void
+emit(const struct odds *o, const char *comment)
+{
+	printf("\t{ %d, %d, %d, %d, %d, %d, %d },\t/* %s */\n", o->total,
+		o->strong, o->weak, o->miss, o->match, o->strong_match,
+		o->miss_match, comment);
+}
+
+int
+main(void)
+{
+	struct odds o, brute, table[ODDS_MAX_MODIFIER + 1];
+	struct momentum_odds mo;
+	char comment[32];
+	double score;
+	int m, a, c1, c2, tick, momentum;
+
+	printf("/* Generated by mkodds.  Do not edit. */\n\n");
+	printf("#include \"isscrolls.h\"\n\n");
+
+	printf("const struct odds action_table[ODDS_MAX_MODIFIER + 1] = {\n");
+	for (m = 0; m <= ODDS_MAX_MODIFIER; m++) {
+		memset(&o, 0, sizeof(o));
+		memset(&brute, 0, sizeof(brute));
+		for (a = 1; a <= 6; a++) {
+			add_score(&o, a + m);
+			for (c1 = 1; c1 <= 10; c1++)
+				for (c2 = 1; c2 <= 10; c2++)
+					enumerate(&brute, a + m, c1, c2);
+		}
+		verify("action modifier", m, &o, &brute);
+		snprintf(comment, sizeof(comment), "+%d", m);
+		emit(&o, comment);
+		table[m] = o;
+	}
+	printf("};\n\n");
+
+	/* A part of a box beats the same dice as the full box */
+	printf("const struct odds progress_table[ODDS_PROGRESS_TICKS + 1] = {\n");
+	for (tick = 0; tick <= ODDS_PROGRESS_TICKS; tick++) {
+		score = tick / 4.0;
+		memset(&o, 0, sizeof(o));
+		memset(&brute, 0, sizeof(brute));
+		add_score(&o, (tick + 3) / 4);
+		for (c1 = 1; c1 <= 10; c1++)
+			for (c2 = 1; c2 <= 10; c2++)
+				enumerate(&brute, score, c1, c2);
+		verify("progress score", score, &o, &brute);
+		snprintf(comment, sizeof(comment), "%.2f", score);
+		emit(&o, comment);
+	}
+	printf("};\n\n");
+
+	printf("const struct momentum_odds momentum_table[(ODDS_MAX_MODIFIER + 1) * "
+		"ODDS_MOMENTUM_VALUES] = {\n");
+	for (m = 0; m <= ODDS_MAX_MODIFIER; m++) {
+		for (momentum = ODDS_MIN_MOMENTUM; momentum <= ODDS_MAX_MOMENTUM;
+		    momentum++) {
+			memset(&mo, 0, sizeof(mo));
+			enumerate_momentum(&mo, m, momentum);
+			if (momentum >= 0)
+				verify("plain roll at momentum", momentum,
+					&mo.roll, &table[m]);
+			if (momentum <= 1)
+				verify("burning momentum", momentum, &mo.burn,
+					&mo.roll);
+			printf("\t{ ");
+			emit_odds(&mo.roll);
+			printf(", ");
+			emit_odds(&mo.burn);
+			printf(", %d },\t/* +%d, momentum %d */\n", mo.upgrades, m,
+				momentum);
+		}
+	}
+	printf("};\n");
+
+	return 0;
+}
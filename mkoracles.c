@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Build helper that reads the oracle JSON files from a directory and writes
+ * a C source file with all tables as const data to stdout.  The tables use
+ * the same layout as the binary caches, so the binary can serve oracle rolls
+ * without any file I/O.  Every roll of every table is checked against the
+ * "Chance" ranges read again from the JSON files, a mismatch fails the build.
+ *
+ * Usage: mkoracles contrib > builtin.c
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isscrolls.h"
+
+/* Names of all emitted tables, index is the number of their arrays */
+static char **names = NULL;
+static size_t nnames = 0;
+
+/* tables.c reports through these, there is no isscrolls.c in here */
+void
+log_debug(__attribute__((unused)) const char *fmt, ...)
+{
+}
+
+void
+log_errx(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "mkoracles: ");
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	exit(prio);
+}
+
+/*
+ * Collect the entries of a table.  Each non-empty row of the parsed table is
+ * an entry covering the rolls up to its row number.
+ */
+static uint32_t
+collect_entries(size_t what, struct oracle_entry *e, const char **text)
+{
+	const char *row;
+	uint32_t n = 0, off = 1;
+	int id;
+
+	for (id = 1; id < oracle_array_rows(what); id++) {
+		row = oracle_array_row(what, id);
+		if (oracle_array_row_len(what, id) == 0)
+			continue;
+		e[n].str = off;
+		e[n].low = n ? e[n - 1].high + 1 : 1;
+		e[n].high = id;
+		text[n++] = row;
+		off += oracle_array_row_len(what, id) + 1;
+	}
+
+	return n;
+}
+
+/* Tables of the current file, looked up by check_oracle_file() */
+struct emitted {
+	struct oracle_table	 t;
+	struct oracle_entry	*entries;
+	uint16_t		*index;
+	char			*strings;
+};
+
+static struct emitted *tables = NULL;
+static size_t ntables = 0;
+
+static const struct oracle_table *
+lookup_table(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ntables; i++)
+		if (strcmp(tables[i].t.name, name) == 0)
+			return &tables[i].t;
+
+	return NULL;
+}
+
+/* Emit a table and keep it in t until the file is checked */
+static void
+emit_table(size_t what, size_t num, struct emitted *t)
+{
+	struct oracle_entry *e;
+	const char **text, *p;
+	char *strings;
+	uint16_t *index;
+	uint32_t n, i;
+	int dice = oracle_array_rows(what) - 1;
+
+	if ((e = calloc(dice + 1, sizeof(*e))) == NULL ||
+	    (text = calloc(dice + 1, sizeof(*text))) == NULL ||
+	    (index = calloc(dice + 1, sizeof(*index))) == NULL)
+		log_errx(1, "calloc\n");
+
+	n = collect_entries(what, e, text);
+	if (build_oracle_index(e, n, index, dice) == -1)
+		log_errx(1, "%s does not cover all rolls\n", oracle_array_name(what));
+
+	/* The same strings as below, the entries point into them */
+	if ((strings = calloc(1, n ? e[n - 1].str +
+	    strlen(text[n - 1]) + 1 : 1)) == NULL)
+		log_errx(1, "calloc\n");
+	for (i = 0; i < n; i++)
+		strcpy(strings + e[i].str, text[i]);
+	t->t.name = names[num];
+	t->t.nentries = n;
+	t->t.dice = dice;
+	t->t.entries = t->entries = e;
+	t->t.index = t->index = index;
+	t->t.strings = t->strings = strings;
+	t->t.prog = NULL;
+
+	printf("/* %s */\n\n", oracle_array_name(what));
+	printf("static const char strings_%zu[] = {\n", num);
+	printf("\t'\\0',\n");
+	for (i = 0; i < n; i++) {
+		printf("\t");
+		for (p = text[i]; *p != '\0'; p++) {
+			if (*p == '\'' || *p == '\\')
+				printf("'\\%c', ", *p);
+			else if (*p >= ' ' && *p <= '~')
+				printf("'%c', ", *p);
+			else
+				printf("'\\%03o', ", (unsigned char)*p);
+		}
+		printf("'\\0',\n");
+	}
+	printf("};\n\n");
+
+	printf("static const struct oracle_entry entries_%zu[%u] = {\n", num, n);
+	for (i = 0; i < n; i++)
+		printf("\t{ %u, %u, %u },\n", e[i].str, e[i].low, e[i].high);
+	printf("};\n\n");
+
+	printf("static const uint16_t index_%zu[%d] = {", num, dice + 1);
+	for (i = 0; i <= (uint32_t)dice; i++)
+		printf("%s%u,", i % 16 == 0 ? "\n\t" : " ", index[i]);
+	printf("\n};\n\n");
+
+	free(text);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct oracle_source *sources;
+	char err[1024];
+	size_t n, i, j;
+	int what;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: mkoracles dir\n");
+		return 1;
+	}
+
+	set_oracle_dir(argv[1]);
+
+	printf("/* Generated by mkoracles from %s.  Do not edit. */\n\n", argv[1]);
+	printf("#include \"isscrolls.h\"\n\n");
+
+	sources = get_oracle_sources(&n);
+	for (i = 0; i < n; i++) {
+		if (read_oracle_file(&sources[i]) == -1)
+			log_errx(1, "Cannot read %s/%s\n", sources[i].dir,
+				sources[i].file);
+		printf("/* %s */\n\n", sources[i].file);
+		ntables = oracle_array_count();
+		if ((tables = calloc(ntables, sizeof(*tables))) == NULL)
+			log_errx(1, "calloc\n");
+		for (j = 0; j < ntables; j++) {
+			if ((names = reallocarray(names, nnames + 1,
+			    sizeof(*names))) == NULL ||
+			    (names[nnames] = strdup(oracle_array_name(j))) == NULL)
+				log_errx(1, "out of memory\n");
+			emit_table(j, nnames++, &tables[j]);
+		}
+		free_oracle_arrays();
+
+		/* Every roll of every table against the JSON file itself */
+		if (check_oracle_file(&sources[i], lookup_table, err,
+		    sizeof(err)) == -1)
+			log_errx(1, "%s: %s\n", sources[i].file, err);
+		for (j = 0; j < ntables; j++) {
+			free(tables[j].entries);
+			free(tables[j].index);
+			free(tables[j].strings);
+		}
+		free(tables);
+	}
+
+	/* The tables with their own commands have to be there */
+	for (what = 0; what < ORACLE_MAX; what++) {
+		for (i = 0; i < nnames; i++)
+			if (strcmp(names[i], oracle_path(what)) == 0)
+				break;
+		if (i == nnames)
+			log_errx(1, "Missing oracle table %s\n", oracle_path(what));
+	}
+
+	printf("const struct oracle_table builtin_tables[] = {\n");
+	for (i = 0; i < nnames; i++) {
+		printf("\t{ \"%s\", sizeof(entries_%zu) / sizeof(entries_%zu[0]),\n"
+			"\t  sizeof(index_%zu) / sizeof(index_%zu[0]) - 1,\n"
+			"\t  entries_%zu, index_%zu, strings_%zu, NULL },\n", names[i],
+			i, i, i, i, i, i, i);
+	}
+	printf("\t{ NULL, 0, 0, NULL, NULL, NULL, NULL }\n};\n");
+
+	return 0;
+}
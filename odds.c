@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Exact odds of action and progress rolls.  The outcomes of all 6x10x10
+ * dice of an action roll and all 10x10 dice of a progress roll are counted
+ * by mkodds at build time for every modifier and progress score.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "isscrolls.h"
+
+#define ODDS_MAXTOKENS	4
+
+static int roll_odds = 0;
+
+enum odds_kind {
+	ODDS_ACTION,
+	ODDS_PROGRESS,
+	ODDS_JOURNEY,
+	ODDS_FIGHT,
+	ODDS_DELVE,
+	ODDS_BONDS,
+};
+
+struct odds_move {
+	const char	*name;
+	enum odds_kind	 kind;
+	const char	*stat;	/* stat of moves that always roll with it */
+};
+
+static const struct odds_move odds_moves[] = {
+	{ "action", ODDS_ACTION, NULL },
+	{ "battle", ODDS_ACTION, NULL },
+	{ "checkyourgear", ODDS_ACTION, "supply" },
+	{ "clash", ODDS_ACTION, NULL },
+	{ "compel", ODDS_ACTION, NULL },
+	{ "delvethedepths", ODDS_ACTION, NULL },
+	{ "drawthecircle", ODDS_ACTION, "heart" },
+	{ "endureharm", ODDS_ACTION, NULL },
+	{ "endurestress", ODDS_ACTION, NULL },
+	{ "enterthefray", ODDS_ACTION, NULL },
+	{ "escapethedepths", ODDS_ACTION, NULL },
+	{ "facedanger", ODDS_ACTION, NULL },
+	{ "facedeath", ODDS_ACTION, "heart" },
+	{ "facedesolation", ODDS_ACTION, "heart" },
+	{ "forgeabond", ODDS_ACTION, "heart" },
+	{ "gatherinformation", ODDS_ACTION, "wits" },
+	{ "heal", ODDS_ACTION, NULL },
+	{ "makecamp", ODDS_ACTION, "supply" },
+	{ "resupply", ODDS_ACTION, "wits" },
+	{ "secureanadvantage", ODDS_ACTION, NULL },
+	{ "sojourn", ODDS_ACTION, "heart" },
+	{ "strike", ODDS_ACTION, NULL },
+	{ "swearanironvow", ODDS_ACTION, "heart" },
+	{ "testyourbond", ODDS_ACTION, "heart" },
+	{ "undertakeajourney", ODDS_ACTION, "wits" },
+	{ "progress", ODDS_PROGRESS, NULL },
+	{ "endthefight", ODDS_FIGHT, NULL },
+	{ "locateyourobjective", ODDS_DELVE, NULL },
+	{ "reachyourdestination", ODDS_JOURNEY, NULL },
+	{ "writeyourepilogue", ODDS_BONDS, NULL },
+	{ NULL, ODDS_ACTION, NULL }
+};
+
+/* Odds of an action roll with modifier, i.e. stat plus bonus, added to the d6 */
+const struct odds *
+action_odds(int modifier)
+{
+	if (modifier < 0)
+		modifier = 0;
+	if (modifier > ODDS_MAX_MODIFIER)
+		modifier = ODDS_MAX_MODIFIER;
+
+	return &action_table[modifier];
+}
+
+/* Odds of a progress roll, scores are rounded up to the next quarter box */
+const struct odds *
+progress_odds(double score)
+{
+	int tick;
+
+	tick = score <= 0 ? 0 : (int)(score * 4);
+	if (tick < score * 4)
+		tick++;
+	if (tick > ODDS_PROGRESS_TICKS)
+		tick = ODDS_PROGRESS_TICKS;
+
+	return &progress_table[tick];
+}
+
+/* Odds of an action roll at a momentum, with and without burning it */
+const struct momentum_odds *
+momentum_odds(int modifier, int momentum)
+{
+	if (modifier < 0)
+		modifier = 0;
+	if (modifier > ODDS_MAX_MODIFIER)
+		modifier = ODDS_MAX_MODIFIER;
+	if (momentum < ODDS_MIN_MOMENTUM)
+		momentum = ODDS_MIN_MOMENTUM;
+	if (momentum > ODDS_MAX_MOMENTUM)
+		momentum = ODDS_MAX_MOMENTUM;
+
+	return &momentum_table[modifier * ODDS_MOMENTUM_VALUES +
+		momentum - ODDS_MIN_MOMENTUM];
+}
+
+/* Show the odds in front of the dice of every action and progress roll */
+void
+show_roll_odds()
+{
+	roll_odds = 1;
+}
+
+void
+print_roll_odds(const struct odds *o)
+{
+	if (!roll_odds)
+		return;
+
+	printf("[%.0f/%.0f/%.0f%%] ", 100.0 * o->strong / o->total,
+		100.0 * o->weak / o->total, 100.0 * o->miss / o->total);
+}
+
+static int
+stat_by_name(const struct character *c, const char *name)
+{
+	if (strcasecmp(name, "edge") == 0)
+		return c->edge;
+	else if (strcasecmp(name, "heart") == 0)
+		return c->heart;
+	else if (strcasecmp(name, "iron") == 0)
+		return c->iron;
+	else if (strcasecmp(name, "shadow") == 0)
+		return c->shadow;
+	else if (strcasecmp(name, "wits") == 0)
+		return c->wits;
+	else if (strcasecmp(name, "health") == 0)
+		return c->health;
+	else if (strcasecmp(name, "spirit") == 0)
+		return c->spirit;
+	else if (strcasecmp(name, "supply") == 0)
+		return c->supply;
+
+	return -1;
+}
+
+/* A stat is either a number or the name of a stat of the current character */
+static int
+parse_stat(const char *arg, int *value)
+{
+	struct character *curchar = get_current_character();
+	char *ep;
+	long lval;
+
+	errno = 0;
+	lval = strtol(arg, &ep, 10);
+	if (arg[0] != '\0' && *ep == '\0') {
+		if (errno == ERANGE || lval < 0 || lval > 10) {
+			printf("Please provide a number between 0 and 10\n");
+			return -1;
+		}
+		*value = lval;
+		return 0;
+	}
+
+	if (curchar == NULL) {
+		printf("No character loaded.  Provide the value of %s as number\n",
+			arg);
+		return -1;
+	}
+
+	if ((*value = stat_by_name(curchar, arg)) == -1) {
+		printf("Unknown stat %s\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static double
+move_progress(enum odds_kind kind)
+{
+	struct character *curchar = get_current_character();
+
+	switch (kind) {
+	case ODDS_JOURNEY:
+		return curchar->j->progress;
+	case ODDS_FIGHT:
+		return curchar->fight->progress;
+	case ODDS_DELVE:
+		return curchar->delve->progress;
+	case ODDS_BONDS:
+		return curchar->bonds;
+	case ODDS_ACTION:
+	case ODDS_PROGRESS:
+		break;
+	}
+
+	return 0;
+}
+
+static void
+print_odds(const struct odds *o)
+{
+	printf("strong hit %6.2f%%\n", 100.0 * o->strong / o->total);
+	printf("weak hit   %6.2f%%\n", 100.0 * o->weak / o->total);
+	printf("miss       %6.2f%%\n", 100.0 * o->miss / o->total);
+	printf("match      %6.2f%% (strong hit %.2f%%, miss %.2f%%)\n",
+		100.0 * o->match / o->total, 100.0 * o->strong_match / o->total,
+		100.0 * o->miss_match / o->total);
+}
+
+static void
+odds_usage(void)
+{
+	printf("Please provide a move and, if needed, a stat and a bonus\n\n");
+	printf("> odds <move> [stat] [bonus]\n\n");
+	printf("Examples:\n");
+	printf("> odds action 3 1\t\t- Odds of an action roll with +3+1\n");
+	printf("> odds facedanger edge\t\t- Face danger with your edge\n");
+	printf("> odds progress 6\t\t- Progress roll with a score of 6\n");
+	printf("> odds reachyourdestination\t- Progress of your journey\n");
+}
+
+void
+cmd_show_odds(char *cmd)
+{
+	const struct odds_move *m;
+	struct character *curchar = get_current_character();
+	char *tokens[ODDS_MAXTOKENS] = { NULL };
+	char *p, *last, *ep;
+	double score;
+	int i = 0, stat, bonus = 0;
+
+	for ((p = strtok_r(cmd, " ", &last)); p;
+	    (p = strtok_r(NULL, " ", &last))) {
+		if (i < ODDS_MAXTOKENS - 1)
+			tokens[i++] = p;
+	}
+	tokens[i] = NULL;
+
+	if (tokens[0] == NULL) {
+		odds_usage();
+		return;
+	}
+
+	for (m = odds_moves; m->name != NULL; m++)
+		if (strcasecmp(m->name, tokens[0]) == 0)
+			break;
+	if (m->name == NULL) {
+		printf("Unknown move %s\n", tokens[0]);
+		return;
+	}
+
+	/* The bonus is the last argument after the stat or score, if needed */
+	i = m->kind == ODDS_ACTION && m->stat == NULL ? 2 :
+		m->kind == ODDS_PROGRESS ? 2 : 1;
+	if (tokens[i] != NULL) {
+		errno = 0;
+		bonus = strtol(tokens[i], &ep, 10);
+		if (*ep != '\0' || errno == ERANGE || bonus < 0 || bonus > 10) {
+			printf("Please provide a bonus between 0 and 10\n");
+			return;
+		}
+	}
+
+	switch (m->kind) {
+	case ODDS_ACTION:
+		if (m->stat != NULL) {
+			if (parse_stat(m->stat, &stat) == -1)
+				return;
+		} else if (tokens[1] == NULL) {
+			odds_usage();
+			return;
+		} else if (parse_stat(tokens[1], &stat) == -1)
+			return;
+		printf("%s with +%d:\n", m->name, stat + bonus);
+		print_odds(action_odds(stat + bonus));
+		break;
+	case ODDS_PROGRESS:
+		if (tokens[1] == NULL) {
+			odds_usage();
+			return;
+		}
+		errno = 0;
+		score = strtod(tokens[1], &ep);
+		if (*ep != '\0' || errno == ERANGE || score < 0 || score > 10) {
+			printf("Please provide a progress score between 0 and 10\n");
+			return;
+		}
+		printf("progress roll with %.2lf:\n", score + bonus);
+		print_odds(progress_odds(score + bonus));
+		break;
+	case ODDS_JOURNEY:
+	case ODDS_FIGHT:
+	case ODDS_DELVE:
+	case ODDS_BONDS:
+		CURCHAR_CHECK();
+		score = move_progress(m->kind);
+		printf("%s with %.2lf:\n", m->name, score + bonus);
+		print_odds(progress_odds(score + bonus));
+		break;
+	}
+}
+
+/* Iterate over the moves, start with *iter = 0, NULL after the last one */
+const char *
+next_odds_move_name(size_t *iter)
+{
+	if (odds_moves[*iter].name == NULL)
+		return NULL;
+
+	return odds_moves[(*iter)++].name;
+}
@@ -21,863 +21,528 @@
 #include <ctype.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
-static char oracle_is_names[200][MAX_NAME_LEN];
-static char oracle_elf_names[100][MAX_NAME_LEN];
-static char oracle_giant_names[100][MAX_NAME_LEN];
-static char oracle_varou_names[100][MAX_NAME_LEN];
-static char oracle_troll_names[100][MAX_NAME_LEN];
-
-static char oracle_action[100][MAX_NAME_LEN];
-static char oracle_theme[100][MAX_NAME_LEN];
-
-static char oracle_rank[100][MAX_RANK_LEN];
-static char oracle_combat_action[100][MAX_PLOT_LEN];
-static char oracle_plot_twist[100][MAX_PLOT_LEN];
-static char oracle_mystic_backslash[100][MAX_MYSTIC_LEN];
-
-static char oracle_regions[100][MAX_PLACES_LEN];
-static char oracle_locations[100][MAX_PLACES_LEN];
-static char oracle_location_descriptions[100][MAX_PLACES_LEN];
-static char oracle_coastal_locations[100][MAX_PLACES_LEN];
-
-static char oracle_pay_the_price[100][MAX_PTP_LEN];
-
-static char oracle_delve_edge[100][MAX_DELVE_LEN];
-static char oracle_delve_shadow[100][MAX_DELVE_LEN];
-static char oracle_delve_wits[100][MAX_DELVE_LEN];
-static char oracle_delve_opportunity[100][MAX_CHAR_LEN];
-static char oracle_delve_danger[100][MAX_CHAR_LEN];
-
-static char oracle_char_role[100][MAX_ROLE_LEN];
-static char oracle_char_goal[100][MAX_GOAL_LEN];
-static char oracle_char_desc[100][MAX_DESC_LEN];
-static char oracle_char_disposition[100][MAX_DISP_LEN];
-static char oracle_char_activity[100][MAX_ACTIVITY_LEN];
-
-static int read_names   = 0;
-static int read_action  = 0;
-static int read_turning = 0;
-static int read_places  = 0;
-static int read_moves   = 0;
-static int read_chars 	= 0;
-
-static void read_names_from_json(void);
-static void read_moves_from_json(void);
-static void read_action_from_json(void);
-static void read_turning_from_json(void);
-static void read_places_from_json(void);
-static void read_chars_from_json(void);
+#define ORACLE_MAX_DEPTH	8
 
-static void
-add_to_array(int what, int id, const char *value)
-{
-	log_debug("%d, %d, %s\n", what, id, value);
-
-	switch (what) {
-	case -1:
-		log_debug("Unknown array\n");
-		return;
-	case ORACLE_IS_NAMES:
-		if (id < 0 || id > 200)
-			return;
-		snprintf(oracle_is_names[id], MAX_NAME_LEN, "%s", value);
-		break;
-	case ORACLE_ELF_NAMES:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_elf_names[id], MAX_NAME_LEN, "%s", value);
-		break;
-	case ORACLE_GIANT_NAMES:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_giant_names[id], MAX_NAME_LEN, "%s", value);
-		break;
-	case ORACLE_VAROU_NAMES:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_varou_names[id], MAX_NAME_LEN, "%s", value);
-		break;
-	case ORACLE_TROLL_NAMES:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_troll_names[id], MAX_NAME_LEN, "%s", value);
-		break;
-	/* -------------------------------------------------------------------- */
-	case ORACLE_ACTIONS:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_action[id], MAX_NAME_LEN, "%s", value);
-		break;
-	case ORACLE_THEMES:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_theme[id], MAX_NAME_LEN, "%s", value);
-		break;
-	/* -------------------------------------------------------------------- */
-	case ORACLE_RANKS:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_rank[id], MAX_RANK_LEN, "%s", value);
-		break;
-	case ORACLE_COMBAT_ACTIONS:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_combat_action[id], MAX_PLOT_LEN, "%s", value);
-		break;
-	case ORACLE_PLOT_TWISTS:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_plot_twist[id], MAX_PLOT_LEN, "%s", value);
-		break;
-	case ORACLE_MYSTIC_BACKSLASH:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_mystic_backslash[id], MAX_MYSTIC_LEN, "%s", value);
-		break;
-	/* -------------------------------------------------------------------- */
-	case ORACLE_REGION:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_regions[id], MAX_PLACES_LEN, "%s", value);
-		break;
-	case ORACLE_LOCATION:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_locations[id], MAX_PLACES_LEN, "%s", value);
-		break;
-	case ORACLE_COASTAL:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_coastal_locations[id], MAX_PLACES_LEN, "%s", value);
-		break;
-	case ORACLE_DESCRIPTION:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_location_descriptions[id], MAX_PLACES_LEN, "%s", value);
-		break;
-	/* -------------------------------------------------------------------- */
-	case ORACLE_PAYTHEPRICE:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_pay_the_price[id], MAX_PTP_LEN, "%s", value);
-		break;
-	/* -------------------------------------------------------------------- */
-	case ORACLE_DELVE_THE_DEPTHS_EDGE:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_delve_edge[id], MAX_DELVE_LEN, "%s", value);
-		break;
-	case ORACLE_DELVE_THE_DEPTHS_WITS:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_delve_wits[id], MAX_DELVE_LEN, "%s", value);
-		break;
-	case ORACLE_DELVE_THE_DEPTHS_SHADOW:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_delve_shadow[id], MAX_DELVE_LEN, "%s", value);
-		break;
-	case ORACLE_DELVE_OPPORTUNITY:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_delve_opportunity[id], MAX_CHAR_LEN, "%s", value);
-		break;
-	case ORACLE_DELVE_DANGER:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_delve_danger[id], MAX_CHAR_LEN, "%s", value);
-		break;
-	/* -------------------------------------------------------------------- */
-	case ORACLE_CHAR_ROLE:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_char_role[id], MAX_ROLE_LEN, "%s", value);
-		break;
-	case ORACLE_CHAR_GOAL:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_char_goal[id], MAX_GOAL_LEN, "%s", value);
-		break;
-	case ORACLE_CHAR_DESC:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_char_desc[id], MAX_DESC_LEN, "%s", value);
-		break;
-	case ORACLE_CHAR_DISPOSITION:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_char_disposition[id], MAX_DISP_LEN, "%s", value);
-		break;
-	case ORACLE_CHAR_ACTIVITY:
-		if (id < 0 || id > 100)
-			return;
-		snprintf(oracle_char_activity[id], MAX_ACTIVITY_LEN, "%s", value);
-		break;
-	default:
-		log_errx(1, "add_to_array: This should not happen\n");
-	}
-}
-
-
-static void
-read_chars_from_json()
-{
-	char path[_POSIX_PATH_MAX];
-	json_object *root, *oracles, *temp, *table, *name, *desc, *chance;
-	size_t n_oracles, n_entries, i, j;
-	int what, ret;
-
-	ret = snprintf(path, sizeof(path), "%s/ironsworn_oracles_character.json", PATH_SHARE_DIR);
-	if (ret < 0 || (size_t)ret >= sizeof(path)) {
-		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
-	}
-
-	if ((root = json_object_from_file(path)) == NULL) {
-		log_errx(1, "Cannot open %s\n", path);
-	}
-
-	if (!json_object_object_get_ex(root, "Oracles", &oracles)) {
-		log_debug("Cannot find a [Oracles] array in %s\n", path);
-		return;
-	}
-
-	n_oracles = json_object_array_length(oracles);
-
-	log_debug("number of oracles: %d\n", n_oracles);
-	for (i = 0; i < n_oracles; i++) {
-		temp = json_object_array_get_idx(oracles, i);
-		json_object_object_get_ex(temp, "Oracle Table", &table);
-		json_object_object_get_ex(temp, "Name", &name);
-		log_debug("Name %s\n", json_object_get_string(name));
-
-		if ((strcmp(json_object_get_string(name), "Role") == 0))
-			what = ORACLE_CHAR_ROLE;
-		else if ((strcmp(json_object_get_string(name), "Goal") == 0))
-			what = ORACLE_CHAR_GOAL;
-		else if ((strcmp(json_object_get_string(name), "Descriptor") == 0))
-			what = ORACLE_CHAR_DESC;
-		else if ((strcmp(json_object_get_string(name), "Disposition") == 0))
-			what = ORACLE_CHAR_DISPOSITION;
-		else if ((strcmp(json_object_get_string(name), "Activity") == 0))
-			what = ORACLE_CHAR_ACTIVITY;
-		else {
-			what = -1;
-			continue;
-		}
-
-		n_entries = json_object_array_length(table);
-		for (j = 0; j < n_entries; j++) {
-			temp = json_object_array_get_idx(table, j);
-			json_object_object_get_ex(temp, "Description", &desc);
-			json_object_object_get_ex(temp, "Chance", &chance);
-				add_to_array(what, json_object_get_int(chance), json_object_get_string(desc));
-		}
-	}
-
-	/* Decrement the reference count of json_object and free if it reaches zero. */
-	json_object_put(root);
-
-	read_chars = 1;
-}
-
-static void
-read_names_from_json()
-{
-	char path[_POSIX_PATH_MAX];
-	json_object *root, *oracles, *temp, *table, *name, *desc, *chance;
-	size_t n_oracles, n_entries, i, j;
-	int what, ret;
-
-	ret = snprintf(path, sizeof(path), "%s/ironsworn_oracles_names.json", PATH_SHARE_DIR);
-	if (ret < 0 || (size_t)ret >= sizeof(path)) {
-		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
-	}
-
-	if ((root = json_object_from_file(path)) == NULL) {
-		log_errx(1, "Cannot open %s\n", path);
-	}
-
-	if (!json_object_object_get_ex(root, "Oracles", &oracles)) {
-		log_debug("Cannot find a [Oracles] array in %s\n", path);
-		return;
-	}
-
-	n_oracles = json_object_array_length(oracles);
-
-	log_debug("number of oracles: %d\n", n_oracles);
-	for (i = 0; i < n_oracles; i++) {
-		temp = json_object_array_get_idx(oracles, i);
-		json_object_object_get_ex(temp, "Oracle Table", &table);
-		json_object_object_get_ex(temp, "Name", &name);
-		log_debug("Name %s\n", json_object_get_string(name));
-
-		if ((strcmp(json_object_get_string(name), "Ironlander Names") == 0))
-			what = ORACLE_IS_NAMES;
-		else if ((strcmp(json_object_get_string(name), "Elf Names") == 0))
-			what = ORACLE_ELF_NAMES;
-		else if ((strcmp(json_object_get_string(name), "Giant Names") == 0))
-			what = ORACLE_GIANT_NAMES;
-		else if ((strcmp(json_object_get_string(name), "Varou Names") == 0))
-			what = ORACLE_VAROU_NAMES;
-		else if ((strcmp(json_object_get_string(name), "Troll Names") == 0))
-			what = ORACLE_TROLL_NAMES;
-		else {
-			what = -1;
-			continue;
-		}
-
-		n_entries = json_object_array_length(table);
-		for (j = 0; j < n_entries; j++) {
-			temp = json_object_array_get_idx(table, j);
-			json_object_object_get_ex(temp, "Description", &desc);
-			json_object_object_get_ex(temp, "Chance", &chance);
-				add_to_array(what, json_object_get_int(chance), json_object_get_string(desc));
-		}
-	}
-
-	/* Decrement the reference count of json_object and free if it reaches zero. */
-	json_object_put(root);
-
-	read_names = 1;
-}
-
-static void
-read_moves_from_json()
-{
-	char path[_POSIX_PATH_MAX];
-	json_object *root, *oracles, *temp, *table, *name, *desc, *chance;
-	size_t n_oracles, n_entries, i, j;
-	int what, ret;
-
-	ret = snprintf(path, sizeof(path), "%s/ironsworn_move_oracles.json", PATH_SHARE_DIR);
-	if (ret < 0 || (size_t)ret >= sizeof(path)) {
-		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
-	}
-
-	if ((root = json_object_from_file(path)) == NULL) {
-		log_errx(1, "Cannot open %s\n", path);
-	}
-
-	if (!json_object_object_get_ex(root, "Oracles", &oracles)) {
-		log_debug("Cannot find a [Oracles] array in %s\n", path);
-		return;
-	}
-
-	n_oracles = json_object_array_length(oracles);
-
-	log_debug("number of oracles: %d\n", n_oracles);
-	for (i = 0; i < n_oracles; i++) {
-		temp = json_object_array_get_idx(oracles, i);
-		json_object_object_get_ex(temp, "Oracle Table", &table);
-		json_object_object_get_ex(temp, "Name", &name);
-		log_debug("Name %s\n", json_object_get_string(name));
-
-		if ((strcmp(json_object_get_string(name), "Pay the Price") == 0))
-			what = ORACLE_PAYTHEPRICE;
-		else if ((strcmp(json_object_get_string(name), "Delve the Depths - Edge") == 0))
-			what = ORACLE_DELVE_THE_DEPTHS_EDGE;
-		else if ((strcmp(json_object_get_string(name), "Delve the Depths - Shadow") == 0))
-			what = ORACLE_DELVE_THE_DEPTHS_SHADOW;
-		else if ((strcmp(json_object_get_string(name), "Delve the Depths - Wits") == 0))
-			what = ORACLE_DELVE_THE_DEPTHS_WITS;
-		else if ((strcmp(json_object_get_string(name), "Find an Opportunity") == 0))
-			what = ORACLE_DELVE_OPPORTUNITY;
-		else if ((strcmp(json_object_get_string(name), "Reveal a Danger") == 0))
-			what = ORACLE_DELVE_DANGER;
-		else {
-			what = -1;
-			continue;
-		}
-
-		n_entries = json_object_array_length(table);
-		for (j = 0; j < n_entries; j++) {
-			temp = json_object_array_get_idx(table, j);
-			json_object_object_get_ex(temp, "Description", &desc);
-			json_object_object_get_ex(temp, "Chance", &chance);
-			add_to_array(what, json_object_get_int(chance), json_object_get_string(desc));
-		}
-	}
-
-	/* Decrement the reference count of json_object and free if it reaches zero. */
-	json_object_put(root);
-
-	read_moves = 1;
-}
-
-static void
-read_action_from_json()
-{
-	char path[_POSIX_PATH_MAX];
-	json_object *root, *oracles, *temp, *table, *name, *desc, *chance;
-	size_t n_oracles, n_entries, i, j;
-	int what, ret;
-
-	ret = snprintf(path, sizeof(path), "%s/ironsworn_oracles_prompts.json", PATH_SHARE_DIR);
-	if (ret < 0 || (size_t)ret >= sizeof(path)) {
-		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
-	}
-
-	if ((root = json_object_from_file(path)) == NULL) {
-		log_errx(1, "Cannot open %s\n", path);
-	}
-
-	if (!json_object_object_get_ex(root, "Oracles", &oracles)) {
-		log_debug("Cannot find a [Oracles] array in %s\n", path);
-		return;
-	}
-
-	n_oracles = json_object_array_length(oracles);
-
-	log_debug("number of oracles: %d\n", n_oracles);
-	for (i = 0; i < n_oracles; i++) {
-		temp = json_object_array_get_idx(oracles, i);
-		json_object_object_get_ex(temp, "Oracle Table", &table);
-		json_object_object_get_ex(temp, "Name", &name);
-		log_debug("Name %s\n", json_object_get_string(name));
-
-		if ((strcmp(json_object_get_string(name), "Action") == 0))
-			what = ORACLE_ACTIONS;
-		else if ((strcmp(json_object_get_string(name), "Theme") == 0))
-			what = ORACLE_THEMES;
-		/* The following oracles are not yet supported */
-		else if ((strcmp(json_object_get_string(name), "Feature") == 0))
-			continue;
-		else if ((strcmp(json_object_get_string(name), "Focus") == 0))
-			continue;
-		else if ((strcmp(json_object_get_string(name), "Trap") == 0))
-			continue;
-		else if ((strcmp(json_object_get_string(name), "Combat Event") == 0))
-			continue;
-		else {
-			what = -1;
-			continue;
-		}
-
-		n_entries = json_object_array_length(table);
-		for (j = 0; j < n_entries; j++) {
-			temp = json_object_array_get_idx(table, j);
-			json_object_object_get_ex(temp, "Description", &desc);
-			json_object_object_get_ex(temp, "Chance", &chance);
-			add_to_array(what, json_object_get_int(chance), json_object_get_string(desc));
-		}
-	}
-
-	/* Decrement the reference count of json_object and free if it reaches zero. */
-	json_object_put(root);
-
-	read_action = 1;
-}
-
-static void
-read_turning_from_json()
-{
-	char path[_POSIX_PATH_MAX];
-	json_object *root, *oracles, *temp, *table, *name, *desc, *chance;
-	size_t n_oracles, n_entries, i, j;
-	int what, ret;
-
-	ret = snprintf(path, sizeof(path), "%s/ironsworn_oracles_turning_point.json", PATH_SHARE_DIR);
-	if (ret < 0 || (size_t)ret >= sizeof(path)) {
-		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
-	}
-
-	if ((root = json_object_from_file(path)) == NULL) {
-		log_errx(1, "Cannot open %s\n", path);
-	}
-
-	if (!json_object_object_get_ex(root, "Oracles", &oracles)) {
-		log_debug("Cannot find a [Oracles] array in %s\n", path);
-		return;
-	}
-
-	n_oracles = json_object_array_length(oracles);
-
-	log_debug("number of oracles: %d\n", n_oracles);
-	for (i = 0; i < n_oracles; i++) {
-		temp = json_object_array_get_idx(oracles, i);
-		json_object_object_get_ex(temp, "Oracle Table", &table);
-		json_object_object_get_ex(temp, "Name", &name);
-		log_debug("Name %s\n", json_object_get_string(name));
-
-		if ((strcmp(json_object_get_string(name), "Challenge Rank") == 0))
-			what = ORACLE_RANKS;
-		else if ((strcmp(json_object_get_string(name), "Combat Action") == 0))
-			what = ORACLE_COMBAT_ACTIONS;
-		else if ((strcmp(json_object_get_string(name), "Major Plot Twist") == 0))
-			what = ORACLE_PLOT_TWISTS;
-		else if ((strcmp(json_object_get_string(name), "Mystic Backlash") == 0))
-			what = ORACLE_MYSTIC_BACKSLASH;
-		else {
-			what = -1;
-			continue;
-		}
-
-		n_entries = json_object_array_length(table);
-		for (j = 0; j < n_entries; j++) {
-			temp = json_object_array_get_idx(table, j);
-			json_object_object_get_ex(temp, "Description", &desc);
-			json_object_object_get_ex(temp, "Chance", &chance);
-			add_to_array(what, json_object_get_int(chance), json_object_get_string(desc));
-		}
-	}
-
-	/* Decrement the reference count of json_object and free if it reaches zero. */
-	json_object_put(root);
-
-	read_turning = 1;
-}
-
-static void
-read_places_from_json()
-{
-	char path[_POSIX_PATH_MAX];
-	json_object *root, *oracles, *temp, *table, *name, *desc, *chance;
-	size_t n_oracles, n_entries, i, j;
-	int what, ret;
-
-	ret = snprintf(path, sizeof(path), "%s/ironsworn_oracles_place.json", PATH_SHARE_DIR);
-	if (ret < 0 || (size_t)ret >= sizeof(path)) {
-		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
-	}
-
-	if ((root = json_object_from_file(path)) == NULL) {
-		log_errx(1, "Cannot open %s\n", path);
-	}
-
-	if (!json_object_object_get_ex(root, "Oracles", &oracles)) {
-		log_debug("Cannot find a [Oracles] array in %s\n", path);
-		return;
-	}
-
-	n_oracles = json_object_array_length(oracles);
-
-	log_debug("number of oracles: %d\n", n_oracles);
-	for (i = 0; i < n_oracles; i++) {
-		temp = json_object_array_get_idx(oracles, i);
-		json_object_object_get_ex(temp, "Oracle Table", &table);
-		json_object_object_get_ex(temp, "Name", &name);
-		log_debug("Name %s\n", json_object_get_string(name));
-
-		if ((strcmp(json_object_get_string(name), "Region") == 0))
-			what = ORACLE_REGION;
-		else if ((strcmp(json_object_get_string(name), "Location") == 0))
-			what = ORACLE_LOCATION;
-		else if ((strcmp(json_object_get_string(name), "Coastal Waters Location") == 0))
-			what = ORACLE_COASTAL;
-		else if ((strcmp(json_object_get_string(name), "Location Descriptors") == 0))
-			what = ORACLE_DESCRIPTION;
-		else {
-			what = -1;
-			continue;
-		}
-
-		n_entries = json_object_array_length(table);
-		for (j = 0; j < n_entries; j++) {
-			temp = json_object_array_get_idx(table, j);
-			json_object_object_get_ex(temp, "Description", &desc);
-			json_object_object_get_ex(temp, "Chance", &chance);
-			add_to_array(what, json_object_get_int(chance), json_object_get_string(desc));
-		}
-	}
-
-	/* Decrement the reference count of json_object and free if it reaches zero. */
-	json_object_put(root);
-
-	read_places = 1;
-}
+/*
+ * Entries are compiled into a list of operations the first time their table
+ * is used, so rolls never have to look at the text of an entry again.
+ */
+enum oracle_op_code {
+	OP_TEXT,	/* print text */
+	OP_ROLL,	/* roll count times on the same table */
+	OP_TABLE,	/* roll on the table called name */
+};
+
+struct oracle_op {
+	enum oracle_op_code		  code;
+	int				  count;
+	const char			 *text;	/* text or directive in the entry */
+	size_t				  len;
+	char				 *name;
+	int				  resolved;
+	const struct oracle_table	**targets;
+	size_t				  ntargets;
+};
+
+struct oracle_prog {
+	struct oracle_op	*ops;
+	size_t			 nops;
+	size_t			 maxops;
+	uint32_t		*first;	/* ops of entry i are first[i] to first[i + 1] - 1 */
+};
+
+struct oracle_stack {
+	const struct oracle_table	*tables[ORACLE_MAX_DEPTH];
+	int				 depth;
+};
+
+static void expand_entry(FILE *, const struct oracle_table *, uint32_t,
+	struct oracle_stack *);
 
 void
 cmd_show_iron_name(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_IS_NAMES, 200);
+	show_info_from_oracle(0, ORACLE_IS_NAMES);
 }
 
 void
 cmd_show_elf_name(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_ELF_NAMES, 100);
+	show_info_from_oracle(0, ORACLE_ELF_NAMES);
 }
 
 void
 cmd_show_giant_name(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_GIANT_NAMES, 100);
+	show_info_from_oracle(0, ORACLE_GIANT_NAMES);
 }
 
 void
 cmd_show_varou_name(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_VAROU_NAMES, 100);
+	show_info_from_oracle(0, ORACLE_VAROU_NAMES);
 }
 
 void
 cmd_show_troll_name(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_TROLL_NAMES, 100);
+	show_info_from_oracle(0, ORACLE_TROLL_NAMES);
 }
 
 void
 cmd_show_action(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_ACTIONS, 100);
+	show_info_from_oracle(0, ORACLE_ACTIONS);
 }
 
 void
 cmd_show_theme(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_THEMES, 100);
+	show_info_from_oracle(0, ORACLE_THEMES);
 }
 
 void
 cmd_show_rank(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_RANKS, 100);
+	show_info_from_oracle(0, ORACLE_RANKS);
 }
 
 void
 cmd_show_combat_action(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_COMBAT_ACTIONS, 100);
+	show_info_from_oracle(0, ORACLE_COMBAT_ACTIONS);
 }
 
 void
 cmd_show_plot_twist(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_PLOT_TWISTS, 100);
+	show_info_from_oracle(0, ORACLE_PLOT_TWISTS);
 }
 
 void
 cmd_show_mystic_backshlash(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_MYSTIC_BACKSLASH, 100);
+	show_info_from_oracle(0, ORACLE_MYSTIC_BACKSLASH);
 }
 
 void
 cmd_show_location(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_LOCATION, 100);
+	show_info_from_oracle(0, ORACLE_LOCATION);
 }
 
 void
 cmd_show_location_description(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_DESCRIPTION, 100);
+	show_info_from_oracle(0, ORACLE_DESCRIPTION);
 }
 
 void
 cmd_show_coastal_location(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_COASTAL, 100);
+	show_info_from_oracle(0, ORACLE_COASTAL);
 }
 
 void
 cmd_show_region(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_REGION, 100);
+	show_info_from_oracle(0, ORACLE_REGION);
 }
 
 void
 cmd_show_pay_the_price(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_PAYTHEPRICE, 100);
+	show_info_from_oracle(0, ORACLE_PAYTHEPRICE);
 }
 
 void
 cmd_find_an_opportunity(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_DELVE_OPPORTUNITY, 100);
+	show_info_from_oracle(0, ORACLE_DELVE_OPPORTUNITY);
 }
 
 void
 cmd_reveal_a_danger(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(0, ORACLE_DELVE_DANGER, 100);
+	show_info_from_oracle(0, ORACLE_DELVE_DANGER);
 }
 
 void
 cmd_generate_npc(__attribute__((unused))char *unused)
 {
-	show_info_from_oracle(1, ORACLE_IS_NAMES, 100);
+	show_info_from_oracle(1, ORACLE_IS_NAMES);
 	printf(" the ");
-	show_info_from_oracle(1, ORACLE_CHAR_ROLE, 100);
+	show_info_from_oracle(1, ORACLE_CHAR_ROLE);
 	printf(" is a ");
-	show_info_from_oracle(1, ORACLE_CHAR_DESC, 100);
+	show_info_from_oracle(1, ORACLE_CHAR_DESC);
 	printf(" person whose goal is to ");
-	show_info_from_oracle(1, ORACLE_CHAR_GOAL, 100);
+	show_info_from_oracle(1, ORACLE_CHAR_GOAL);
 	printf(".\n");
 }
 
+/* Roll on any oracle table by its name, e.g. "oracle settlement/trouble" */
 void
-show_info_from_oracle(int action, int what, int max)
+cmd_roll_oracle_table(char *name)
 {
-	char temp[255];
-	long die, die2, saved_die;
+	const struct oracle_table *t;
+	long die;
 
-roll_again:
-	die = saved_die = roll_oracle_die();
-	if (die < 0 || die >= max)
+	if ((t = lookup_oracle_table(name)) == NULL) {
+		printf("Unknown oracle table %s.  Press TAB to see all tables\n",
+			name);
 		return;
-
-	memset(temp, 0, sizeof(temp));
-
-	if (read_names == 0)
-		read_names_from_json();
-	if (read_action == 0)
-		read_action_from_json();
-	if (read_turning == 0)
-		read_turning_from_json();
-	if (read_places == 0)
-		read_places_from_json();
-	if (read_moves == 0)
-		read_moves_from_json();
-	if (read_chars == 0)
-		read_chars_from_json();
-
-	switch(what) {
-	case ORACLE_IS_NAMES:
-		die2 = roll_oracle_die();
-		die += die2;
-		snprintf(temp, sizeof(temp), "%s", oracle_is_names[die]);
-		break;
-	case ORACLE_ELF_NAMES:
-		while (strlen(oracle_elf_names[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_elf_names[die]);
-		break;
-	case ORACLE_GIANT_NAMES:
-		while (strlen(oracle_giant_names[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_giant_names[die]);
-		break;
-	case ORACLE_VAROU_NAMES:
-		while (strlen(oracle_varou_names[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_varou_names[die]);
-		break;
-	case ORACLE_TROLL_NAMES:
-		while (strlen(oracle_troll_names[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_troll_names[die]);
-		break;
-	case ORACLE_ACTIONS:
-		while (strlen(oracle_action[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_action[die]);
-		break;
-	case ORACLE_THEMES:
-		while (strlen(oracle_theme[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_theme[die]);
-		break;
-	case ORACLE_RANKS:
-		while (strlen(oracle_rank[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_rank[die]);
-		break;
-	case ORACLE_COMBAT_ACTIONS:
-		while (strlen(oracle_combat_action[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_combat_action[die]);
-		break;
-	case ORACLE_PLOT_TWISTS:
-		while (strlen(oracle_plot_twist[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_plot_twist[die]);
-		break;
-	case ORACLE_MYSTIC_BACKSLASH:
-		while (strlen(oracle_mystic_backslash[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_mystic_backslash[die]);
-		break;
-	case ORACLE_REGION:
-		while (strlen(oracle_regions[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_regions[die]);
-		break;
-	case ORACLE_LOCATION:
-		while (strlen(oracle_locations[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_locations[die]);
-		break;
-	case ORACLE_COASTAL:
-		while (strlen(oracle_coastal_locations[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_coastal_locations[die]);
-		break;
-	case ORACLE_DESCRIPTION:
-		while (strlen(oracle_location_descriptions[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_location_descriptions[die]);
-		break;
-	case ORACLE_PAYTHEPRICE:
-		while (strlen(oracle_pay_the_price[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_pay_the_price[die]);
-		break;
-	case ORACLE_DELVE_THE_DEPTHS_EDGE:
-		while (strlen(oracle_delve_edge[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_delve_edge[die]);
-		break;
-	case ORACLE_DELVE_THE_DEPTHS_WITS:
-		while (strlen(oracle_delve_wits[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_delve_wits[die]);
-		break;
-	case ORACLE_DELVE_THE_DEPTHS_SHADOW:
-		while (strlen(oracle_delve_shadow[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_delve_shadow[die]);
-		break;
-	case ORACLE_DELVE_OPPORTUNITY:
-		while (strlen(oracle_delve_opportunity[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_delve_opportunity[die]);
-		break;
-	case ORACLE_DELVE_DANGER:
-		while (strlen(oracle_delve_danger[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_delve_danger[die]);
-		break;
-	case ORACLE_CHAR_ROLE:
-		while (strlen(oracle_char_role[die]) == 0)
-			die++;
-		if (die == 100)
-			goto roll_again;
-		snprintf(temp, sizeof(temp), "%s", oracle_char_role[die]);
-		break;
-	case ORACLE_CHAR_GOAL:
-		while (strlen(oracle_char_goal[die]) == 0)
-			die++;
-		if (die == 100)
-			goto roll_again;
-		snprintf(temp, sizeof(temp), "%s", oracle_char_goal[die]);
-		break;
-	case ORACLE_CHAR_DESC:
-		while (strlen(oracle_char_desc[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_char_desc[die]);
-		break;
-	case ORACLE_CHAR_DISPOSITION:
-		while (strlen(oracle_char_disposition[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_char_disposition[die]);
-		break;
-	case ORACLE_CHAR_ACTIVITY:
-		while (strlen(oracle_char_activity[die]) == 0)
-			die++;
-		snprintf(temp, sizeof(temp), "%s", oracle_char_activity[die]);
-		break;
 	}
 
+	die = roll_die(t->dice);
+	oracle_expand(stdout, t, die);
+	printf(" <%ld>\n", die);
+}
+
+/*
+ * "Unusual role" and "[Roll twice]" do not make sense for a generated NPC, so
+ * only roll on the entries below them
+ */
+long
+oracle_dice(int what, const struct oracle_table *t)
+{
+	if ((what == ORACLE_CHAR_ROLE || what == ORACLE_CHAR_GOAL) &&
+	    t->nentries > 1)
+		return t->entries[t->nentries - 1].low - 1;
+
+	return t->dice;
+}
+
+void
+show_info_from_oracle(int action, int what)
+{
+	const struct oracle_table *t;
+	char *temp;
+	size_t len;
+	long die;
+	FILE *f;
+
+	if ((t = get_oracle_table(what)) == NULL)
+		return;
+
+	die = roll_die(oracle_dice(what, t));
+
 	if (action) {
+		if ((f = open_memstream(&temp, &len)) == NULL)
+			log_errx(1, "open_memstream");
+		oracle_expand(f, t, die);
+		fclose(f);
 		if (what != ORACLE_IS_NAMES)
 			convert_to_lowercase(temp);
 		printf("%s", temp);
-	} else
-		printf("%s <%ld>\n", temp, saved_die);
+		free(temp);
+	} else {
+		oracle_expand(stdout, t, die);
+		printf(" <%ld>\n", die);
+	}
+}
+
+static struct oracle_op *
+add_op(struct oracle_prog *p, enum oracle_op_code code, const char *text,
+	size_t len)
+{
+	struct oracle_op *op;
+	size_t max;
+
+	if (p->nops == p->maxops) {
+		max = p->maxops ? p->maxops * 2 : 64;
+		if ((op = reallocarray(p->ops, max, sizeof(*op))) == NULL)
+			log_errx(1, "reallocarray");
+		p->ops = op;
+		p->maxops = max;
+	}
+
+	op = &p->ops[p->nops++];
+	memset(op, 0, sizeof(*op));
+	op->code = code;
+	op->count = 1;
+	op->text = text;
+	op->len = len;
+
+	return op;
+}
+
+static void
+add_table_op(struct oracle_prog *p, const char *dir, int dirlen,
+	const char *name, const char *text, size_t len)
+{
+	char path[_POSIX_PATH_MAX];
+	struct oracle_op *op;
+	int ret;
+
+	ret = snprintf(path, sizeof(path), "%.*s/%s", dirlen, dir, name);
+	if (ret < 0 || (size_t)ret >= sizeof(path)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
+	}
+
+	op = add_op(p, OP_TABLE, text, len);
+	if ((op->name = strdup(path)) == NULL)
+		log_errx(1, "strdup");
+}
+
+/*
+ * Directives understood in an entry:
+ *
+ * "Roll twice more on this table..."	roll twice on the same table
+ * "Roll again and apply..."		roll once more on the same table
+ * "[Roll twice]"			roll twice on the same table
+ * "[Detail]" or "{Place}"		roll on the table next to this one
+ *
+ * An entry with its own table, like the kinds of settlement names, rolls on
+ * that table.
+ */
+static void
+compile_entry(struct oracle_prog *p, const struct oracle_table *t,
+	const char *s)
+{
+	char name[NAME_MAX], token[NAME_MAX];
+	const char *lit, *open, *close;
+	struct oracle_op *op;
+	int dirlen;
+
+	if (strncmp(s, "Roll twice", 10) == 0 ||
+	    strncmp(s, "Roll again", 10) == 0) {
+		add_op(p, OP_TEXT, s, strlen(s));
+		add_op(p, OP_TEXT, " (", 2);
+		op = add_op(p, OP_ROLL, s, strlen(s));
+		op->count = s[5] == 't' ? 2 : 1;
+		add_op(p, OP_TEXT, ")", 1);
+		return;
+	}
+
+	normalize_name(s, NULL, name, sizeof(name));
+	snprintf(token, sizeof(token), "%s/%s", t->name, name);
+	if (has_oracle_table(token)) {
+		add_op(p, OP_TEXT, s, strlen(s));
+		add_op(p, OP_TEXT, ": ", 2);
+		add_table_op(p, t->name, strlen(t->name), name, s, strlen(s));
+		return;
+	}
+
+	dirlen = strrchr(t->name, '/') ? strrchr(t->name, '/') - t->name : 0;
+	for (lit = s; (open = strpbrk(lit, "[{")) != NULL; lit = close + 1) {
+		if ((close = strchr(open, *open == '[' ? ']' : '}')) == NULL)
+			break;
+		if (open > lit)
+			add_op(p, OP_TEXT, lit, open - lit);
+
+		snprintf(token, sizeof(token), "%.*s", (int)(close - open - 1),
+			open + 1);
+		if (strcasecmp(token, "Roll twice") == 0) {
+			op = add_op(p, OP_ROLL, open, close - open + 1);
+			op->count = 2;
+		} else {
+			normalize_name(token, NULL, name, sizeof(name));
+			add_table_op(p, t->name, dirlen, name, open,
+				close - open + 1);
+		}
+	}
+
+	if (*lit != '\0')
+		add_op(p, OP_TEXT, lit, strlen(lit));
+}
+
+struct oracle_prog *
+compile_oracle_table(const struct oracle_table *t)
+{
+	struct oracle_prog *p;
+	uint32_t i;
+
+	if ((p = calloc(1, sizeof(*p))) == NULL ||
+	    (p->first = calloc(t->nentries + 1, sizeof(*p->first))) == NULL)
+		log_errx(1, "calloc");
+
+	for (i = 0; i < t->nentries; i++) {
+		p->first[i] = p->nops;
+		compile_entry(p, t, t->strings + t->entries[i].str);
+	}
+	p->first[t->nentries] = p->nops;
+
+	return p;
+}
+
+/* Forget the resolved targets of all table references, e.g. after a reload */
+void
+reset_oracle_prog(struct oracle_prog *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->nops; i++) {
+		free(p->ops[i].targets);
+		p->ops[i].targets = NULL;
+		p->ops[i].ntargets = 0;
+		p->ops[i].resolved = 0;
+	}
+}
+
+void
+free_oracle_prog(struct oracle_prog *p)
+{
+	size_t i;
+
+	if (p == NULL)
+		return;
+
+	reset_oracle_prog(p);
+	for (i = 0; i < p->nops; i++)
+		free(p->ops[i].name);
+	free(p->ops);
+	free(p->first);
+	free(p);
+}
+
+/*
+ * The target of a table reference is looked up once.  If there is no table
+ * with that name but tables below it, e.g. "{Place}" for the places of all
+ * delve site domains, one of those is picked at random on every roll.
+ */
+static const struct oracle_table *
+resolve_target(struct oracle_op *op)
+{
+	const struct oracle_table *t;
+	const char *name, **names = NULL;
+	size_t iter = 0, len, n = 0, i;
+
+	if (!op->resolved) {
+		op->resolved = 1;
+
+		if ((t = lookup_oracle_table(op->name)) != NULL) {
+			if ((op->targets = calloc(1, sizeof(*op->targets))) == NULL)
+				log_errx(1, "calloc");
+			op->targets[op->ntargets++] = t;
+		} else {
+			len = strlen(op->name);
+			while ((name = next_oracle_table_name(&iter)) != NULL) {
+				if (strncmp(name, op->name, len) != 0 ||
+				    name[len] != '/' || strchr(name + len + 1, '/'))
+					continue;
+				if ((names = reallocarray(names, n + 1,
+				    sizeof(*names))) == NULL)
+					log_errx(1, "reallocarray");
+				names[n++] = name;
+			}
+
+			if (n > 0 && (op->targets = calloc(n,
+			    sizeof(*op->targets))) == NULL)
+				log_errx(1, "calloc");
+			for (i = 0; i < n; i++)
+				if ((t = lookup_oracle_table(names[i])) != NULL)
+					op->targets[op->ntargets++] = t;
+			free(names);
+		}
+	}
+
+	if (op->ntargets == 0)
+		return NULL;
+
+	return op->targets[roll_die(op->ntargets) - 1];
+}
+
+static int
+on_stack(const struct oracle_stack *st, const struct oracle_table *t)
+{
+	int i;
+
+	for (i = 0; i < st->depth; i++)
+		if (st->tables[i] == t)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Expand one entry.  Rolling again on the same table skips the entry that
+ * asked for it.  Each table reference goes one level deeper, a table that
+ * is already being expanded or the depth limit stop the expansion and print
+ * the directive as it is.
+ */
+static void
+expand_entry(FILE *out, const struct oracle_table *t, uint32_t entry,
+	struct oracle_stack *st)
+{
+	const struct oracle_table *target;
+	struct oracle_op *op;
+	uint32_t i, hit;
+	int n;
+
+	if (t->prog == NULL || st->depth >= ORACLE_MAX_DEPTH) {
+		fputs(t->strings + t->entries[entry].str, out);
+		return;
+	}
+
+	st->tables[st->depth++] = t;
+
+	for (i = t->prog->first[entry]; i < t->prog->first[entry + 1]; i++) {
+		op = &t->prog->ops[i];
+		switch (op->code) {
+		case OP_TEXT:
+			fwrite(op->text, 1, op->len, out);
+			break;
+		case OP_ROLL:
+			if (t->nentries < 2 || st->depth >= ORACLE_MAX_DEPTH) {
+				fwrite(op->text, 1, op->len, out);
+				break;
+			}
+			for (n = 0; n < op->count; n++) {
+				do {
+					hit = t->index[roll_die(t->dice)];
+				} while (hit == entry);
+				if (n > 0)
+					fputs("; ", out);
+				expand_entry(out, t, hit, st);
+			}
+			break;
+		case OP_TABLE:
+			target = resolve_target(op);
+			if (target == NULL || on_stack(st, target) ||
+			    st->depth >= ORACLE_MAX_DEPTH) {
+				fwrite(op->text, 1, op->len, out);
+				break;
+			}
+			expand_entry(out, target,
+				target->index[roll_die(target->dice)], st);
+			break;
+		}
+	}
+
+	st->depth--;
+}
+
+/*
+ * Return the text of the entry for a roll if it needs no expansion, NULL
+ * otherwise.  Lets bulk rolls skip oracle_expand() for plain entries.
+ */
+const char *
+oracle_plain(const struct oracle_table *t, long die)
+{
+	uint32_t entry = t->index[die], first;
+
+	if (t->prog != NULL) {
+		first = t->prog->first[entry];
+		if (t->prog->first[entry + 1] - first != 1 ||
+		    t->prog->ops[first].code != OP_TEXT)
+			return NULL;
+	}
+
+	return t->strings + t->entries[entry].str;
+}
+
+/* Print the fully resolved result of a roll on a table */
+void
+oracle_expand(FILE *out, const struct oracle_table *t, long die)
+{
+	struct oracle_stack st;
+
+	st.depth = 0;
+	expand_entry(out, t, t->index[die], &st);
 }
 
 void
@@ -11,29 +11,43 @@
  * LICENSE: GNU GPL v2
  */
 
+#include <sys/param.h>
+
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "isscrolls.h"
 
+#define CMDHASH_MAX_BUCKET	16
+
 static struct command commands[] = {
 	{ "cd", cmd_cd, "Switch to or from a character", 0 },
-	{ "help", cmd_usage, "Show help", 0 },
+	{ "help", cmd_usage, "Show help", 0, 1 },
 	{ "ls", cmd_ls, "List all characters", 0 },
 	{ "quit", cmd_quit, "Quit the program", 0 },
+	{ "replay", cmd_replay, "Run all commands from a file", 0 },
+	{ "macro", cmd_macro, "Define and run sequences of commands", 0 },
+	{ "benchmark", cmd_benchmark, "Measure how fast dice are rolled", 0, 1 },
 	{ "q", cmd_quit, "Quit the program", 1 },
 	{ "--- DICE ROLLS ---", NULL, "", 0 },
-	{ "action", cmd_roll_action_dice, "Perform an action roll", 0 },
-	{ "challenge", cmd_roll_challenge_die, "Roll a challenge die", 0 },
-	{ "oracle", cmd_roll_oracle_die, "Roll two challenge dice as oracle", 0 },
-	{ "yesorno", cmd_yes_or_no, "Roll oracle to answer a yes/no question", 0 },
-	{ "actionoracle", cmd_show_action, "Show a random action oracle", 0 },
+	{ "action", cmd_roll_action_dice, "Perform an action roll", 0, 1 },
+	{ "challenge", cmd_roll_challenge_die, "Roll a challenge die", 0, 1 },
+	{ "oracle", cmd_roll_oracle_die, "Roll two challenge dice or on an oracle table", 0, 1 },
+	{ "deck", cmd_draw_from_deck, "Draw from an oracle table without repeats", 0 },
+	{ "roll", cmd_roll_bulk, "Roll many times on an oracle table or generator", 0, 1 },
+	{ "odds", cmd_show_odds, "Show the odds of a move", 0 },
+	{ "advise", cmd_advise, "Rank the stats and momentum burn of a move", 0 },
+	{ "audit", cmd_audit, "Show how fair the dice have been", 0, 1 },
+	{ "yesorno", cmd_yes_or_no, "Roll oracle to answer a yes/no question", 0, 1 },
+	{ "actionoracle", cmd_show_action, "Show a random action oracle", 0, 1 },
 	{ "--- CHARACTER COMMANDS ---", NULL, "", 0 },
 	{ "create", cmd_create_character, "Create a new character", 0 },
 	{ "delete", cmd_delete_character, "Delete currently loaded character", 0 },
@@ -43,6 +57,8 @@ static struct command commands[] = {
 	{ "markprogress", cmd_mark_progress, "Mark progress in your current endeavour", 0 },
 	{ "markabond", cmd_mark_a_bond, "Mark a bond", 0 },
 	{ "increase", cmd_increase_value, "Increase a character's value", 0 },
+	{ "forecast", cmd_forecast, "Forecast the moves until a progress move is a good bet", 0 },
+	{ "simulate", cmd_simulate, "Simulate many fights, journeys or delves", 0 },
 	{ "toggle", cmd_toggle, "Toggle character's stats", 0 },
 	{ "--- GAME MOVES ---", NULL, "", 0 },
 	{ "battle", cmd_battle, "Roll a 'battle' move", 0 },
@@ -76,27 +92,35 @@ static struct command commands[] = {
 	{ "locateyourobjective", cmd_locate_your_objective, "Roll a 'locate your objective' move", 0 },
 	{ "escapethedepths", cmd_escape_the_depths, "Roll a 'escape the depths' move", 0 },
 	{ "--- ORACLE TABLE ROLLS ---", NULL, "", 0 },
-	{ "generatenpc", cmd_generate_npc, "Generate a random NPC", 0 },
-	{ "coastalwaterlocation", cmd_show_coastal_location, "Show a random coastal water location", 0 },
-	{ "combataction", cmd_show_combat_action, "Show a random combat action move", 0 },
-	{ "elfname", cmd_show_elf_name, "Show a random Elf name", 0 },
-	{ "findanopportunity", cmd_find_an_opportunity, "Show a random opportunity", 0 },
-	{ "giantname", cmd_show_giant_name, "Show a random Giant name", 0 },
-	{ "ironlandername", cmd_show_iron_name, "Show a random Ironlander name", 0 },
-	{ "location", cmd_show_location, "Show a random location", 0 },
-	{ "locationdescription", cmd_show_location_description, "Show a random location description", 0 },
-	{ "mysticbackslash", cmd_show_mystic_backshlash, "Show a random mystic backlash", 0 },
-	{ "paytheprice", cmd_show_pay_the_price, "Show a random pay the price result", 0 },
-	{ "plottwist", cmd_show_plot_twist, "Show a random major plot twist", 0 },
-	{ "rank", cmd_show_rank, "Show a random challenge rank", 0 },
-	{ "region", cmd_show_region, "Show a random region", 0 },
-	{ "revealadanger", cmd_reveal_a_danger, "Show a random danger", 0 },
-	{ "theme", cmd_show_theme, "Show a random theme oracle", 0 },
-	{ "trollname", cmd_show_troll_name, "Show a random Troll name", 0 },
-	{ "varouname", cmd_show_varou_name, "Show a random Varou name", 0 },
+	{ "generatenpc", cmd_generate_npc, "Generate a random NPC", 0, 1 },
+	{ "coastalwaterlocation", cmd_show_coastal_location, "Show a random coastal water location", 0, 1 },
+	{ "combataction", cmd_show_combat_action, "Show a random combat action move", 0, 1 },
+	{ "elfname", cmd_show_elf_name, "Show a random Elf name", 0, 1 },
+	{ "findanopportunity", cmd_find_an_opportunity, "Show a random opportunity", 0, 1 },
+	{ "giantname", cmd_show_giant_name, "Show a random Giant name", 0, 1 },
+	{ "ironlandername", cmd_show_iron_name, "Show a random Ironlander name", 0, 1 },
+	{ "location", cmd_show_location, "Show a random location", 0, 1 },
+	{ "locationdescription", cmd_show_location_description, "Show a random location description", 0, 1 },
+	{ "mysticbackslash", cmd_show_mystic_backshlash, "Show a random mystic backlash", 0, 1 },
+	{ "paytheprice", cmd_show_pay_the_price, "Show a random pay the price result", 0, 1 },
+	{ "plottwist", cmd_show_plot_twist, "Show a random major plot twist", 0, 1 },
+	{ "rank", cmd_show_rank, "Show a random challenge rank", 0, 1 },
+	{ "region", cmd_show_region, "Show a random region", 0, 1 },
+	{ "revealadanger", cmd_reveal_a_danger, "Show a random danger", 0, 1 },
+	{ "theme", cmd_show_theme, "Show a random theme oracle", 0, 1 },
+	{ "trollname", cmd_show_troll_name, "Show a random Troll name", 0, 1 },
+	{ "varouname", cmd_show_varou_name, "Show a random Varou name", 0, 1 },
 	{ (char *)NULL, NULL, (char *)NULL, 0 }
 };
 
+static FILE *batch_fp = NULL;
+
+/* Perfect hash of the command names, built on the first lookup */
+static struct command **cmd_slots = NULL;
+static uint32_t *cmd_disp = NULL;
+static size_t cmd_nslots = 0;
+static size_t cmd_nbuckets = 0;
+
 void
 cmd_usage(__attribute__((unused)) char *unused)
 {
@@ -132,18 +156,134 @@ stripwhite (char *string)
 	return s;
 }
 
+/*
+ * Case insensitive FNV-1a hash of a command name, scrambled by the seed and
+ * mixed at the end, so the low bits of different seeds are independent
+ */
+static uint32_t
+hash_command(const char *name, uint32_t seed)
+{
+	uint32_t h = 0x811c9dc5 ^ (seed * 0x9e3779b9);
+
+	for (; *name != '\0'; name++) {
+		h ^= (unsigned char)tolower((unsigned char)*name);
+		h *= 0x01000193;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static int
+find_in(const int *keys, size_t n, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if (strcasecmp(commands[keys[i]].name, name) == 0)
+			return 1;
+
+	return 0;
+}
+
+/* Try to place all commands of a bucket with the displacement seed d */
+static int
+place_bucket(const int *keys, size_t n, uint32_t d)
+{
+	size_t i, j, slot[CMDHASH_MAX_BUCKET];
+
+	for (i = 0; i < n; i++) {
+		slot[i] = hash_command(commands[keys[i]].name, d) &
+			(cmd_nslots - 1);
+		if (cmd_slots[slot[i]] != NULL)
+			return -1;
+		for (j = 0; j < i; j++)
+			if (slot[j] == slot[i])
+				return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		cmd_slots[slot[i]] = &commands[keys[i]];
+
+	return 0;
+}
+
+/*
+ * Build the perfect hash of all commands.  A command name is hashed into a
+ * bucket first, then the buckets are placed from the largest down, each with
+ * the first displacement seed that puts all its commands into free slots.
+ * Separators are left out and so is a name that is already in the table.
+ */
+static void
+build_command_hash(void)
+{
+	int keys[CMDHASH_MAX_BUCKET];
+	size_t ncmds = 0, i, j, n, size, maxsize = 0;
+	uint32_t *bucket, d;
+
+	for (i = 0; commands[i].name != NULL; i++)
+		ncmds++;
+
+	cmd_nbuckets = ncmds / 2 + 1;
+	for (cmd_nslots = 1; cmd_nslots < 2 * ncmds; cmd_nslots <<= 1)
+		;
+	if ((cmd_slots = calloc(cmd_nslots, sizeof(*cmd_slots))) == NULL ||
+	    (cmd_disp = calloc(cmd_nbuckets, sizeof(*cmd_disp))) == NULL ||
+	    (bucket = calloc(ncmds, sizeof(*bucket))) == NULL)
+		log_errx(1, "calloc");
+
+	for (i = 0; i < ncmds; i++) {
+		bucket[i] = hash_command(commands[i].name, 0) % cmd_nbuckets;
+		for (j = 0, size = 0; j <= i; j++)
+			if (bucket[j] == bucket[i])
+				size++;
+		maxsize = MAX(maxsize, size);
+	}
+	if (maxsize > CMDHASH_MAX_BUCKET)
+		log_errx(1, "Too many commands share a hash bucket\n");
+
+	for (size = maxsize; size > 0; size--) {
+		for (i = 0; i < cmd_nbuckets; i++) {
+			for (j = 0, n = 0; j < ncmds; j++) {
+				if (bucket[j] != i || commands[j].cmd == NULL)
+					continue;
+				/* The first of two equal names wins */
+				if (n > 0 && find_in(keys, n, commands[j].name))
+					continue;
+				keys[n++] = j;
+			}
+			if (n != size)
+				continue;
+			for (d = 1; place_bucket(keys, n, d) == -1; d++)
+				if (d == UINT32_MAX)
+					log_errx(1, "Cannot build the command hash\n");
+			cmd_disp[i] = d;
+		}
+	}
+	free(bucket);
+
+	log_debug("Hashed %zu commands into %zu slots and %zu buckets\n", ncmds,
+		cmd_nslots, cmd_nbuckets);
+}
+
 struct command *
 find_command(char *line)
 {
-	int i;
+	struct command *cmd;
+	uint32_t b;
 
-	for (i=0; commands[i].name; i++) {
-		/* Skip over --- which is a separator for the cmd_usage() */
-		if (strncasecmp(line, "---", 3) == 0)
-			continue;
-		if (strcasecmp(line, commands[i].name) == 0)
-			return &commands[i];
-	}
+	if (cmd_slots == NULL)
+		build_command_hash();
+
+	b = hash_command(line, 0) % cmd_nbuckets;
+	cmd = cmd_slots[hash_command(line, cmd_disp[b]) & (cmd_nslots - 1)];
+	if (cmd != NULL && strcasecmp(line, cmd->name) == 0)
+		return cmd;
 
 	return NULL;
 }
@@ -165,43 +305,71 @@ initialize_readline(const char *base_path)
 	read_history(hist_path);
 }
 
-char **
-my_completion(const char *text, int start, __attribute__((unused))int end)
+/*
+ * Check the commands given with -e, and those chained with ; in them, before
+ * they run.  Returns 1 if one of them needs the characters, 0 if none does
+ * and -1 if one is unknown.
+ */
+int
+commands_need_character(char **lines, size_t n)
 {
-	char **matches;
-
-	matches = (char **)NULL;
-
-	if (start == 0)
-		matches = rl_completion_matches(text, command_generator);
+	struct command *cmd;
+	char word[MAX_CHAR_LEN];
+	const char *p;
+	size_t i, len;
+	int need = 0;
+
+	for (i = 0; i < n; i++) {
+		p = lines[i];
+		while (*(p += strspn(p, "; \t\n")) != '\0') {
+			len = strcspn(p, " \t\n;");
+			if (len >= sizeof(word))
+				len = sizeof(word) - 1;
+			memcpy(word, p, len);
+			word[len] = '\0';
+
+			if ((cmd = find_command(word)) == NULL) {
+				printf("Unknown command %s\n", word);
+				return -1;
+			}
+			if (!cmd->nochar)
+				need = 1;
+
+			/* The body of a macro is checked when it is defined */
+			if (is_macro_definition(lines[i]))
+				break;
+			p += strcspn(p, ";");
+		}
+	}
 
-	return matches;
+	return need;
 }
 
-char *
-command_generator(const char *text, int state)
+/* Names of all commands, iter starts at 0 */
+const char *
+next_command_name(size_t *iter)
 {
 	const char *name;
-	static int list_index;
-	static size_t len;
 
-	if (!state) {
-		list_index = 0;
-		len = strlen(text);
-	}
-
-	while ((name = commands[list_index].name)) {
-		list_index++;
-		if (strncmp(name, text, len) == 0) {
-			return strdup(name);
-		}
+	while ((name = commands[*iter].name) != NULL) {
+		if (commands[(*iter)++].cmd != NULL)
+			return name;
 	}
 
-	return (char *)NULL;
+	return NULL;
 }
 
+/* Run a command with the rest of its line as arguments */
 void
-execute_command(char *line)
+dispatch_command(struct command *cmd, char *args)
+{
+	set_audit_move(cmd->name);
+	((*(cmd->cmd)) (args));
+	flush_audit();
+}
+
+static void
+run_command(char *line)
 {
 	struct command *cmd;
 	char *word;
@@ -235,6 +403,112 @@ execute_command(char *line)
 
 	word = line + i;
 
-	((*(cmd->cmd)) (word));
-	return;
+	dispatch_command(cmd, word);
+}
+
+/* Commands on a line are separated by ;, except in a macro definition */
+void
+execute_command(char *line)
+{
+	char *p;
+
+	if (is_macro_definition(line)) {
+		run_command(line);
+		return;
+	}
+
+	while ((p = strsep(&line, ";")) != NULL) {
+		p = stripwhite(p);
+		if (*p != '\0')
+			run_command(p);
+	}
+}
+
+/*
+ * Read a line like readline(3).  In batch mode, the line comes from the batch
+ * input instead, which also answers the questions of commands.  The newline
+ * is removed and the caller frees the line, NULL means the input ended.
+ */
+char *
+read_input(const char *prompt)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	if (batch_fp == NULL)
+		return readline(prompt);
+
+	if ((len = getline(&line, &size, batch_fp)) == -1) {
+		free(line);
+		return NULL;
+	}
+	if (len > 0 && line[len - 1] == '\n')
+		line[len - 1] = '\0';
+
+	return line;
+}
+
+/* Read all input from fp, NULL turns batch mode off */
+void
+set_batch_input(FILE *fp)
+{
+	batch_fp = fp;
+}
+
+int
+batch_mode()
+{
+	return batch_fp != NULL;
+}
+
+/*
+ * Run the commands of a recorded transcript, e.g. the history file, one per
+ * line.  Together with -s or the dice of a character, the same transcript
+ * gives the same results, which helps to track down bugs and slowdowns.
+ */
+void
+cmd_replay(char *file)
+{
+	static int replaying = 0;
+	struct timespec start, end;
+	char *line = NULL, *res;
+	size_t size = 0, n = 0;
+	double ms;
+	FILE *fp;
+
+	if (file == NULL || strlen(file) == 0) {
+		printf("Provide a file with commands as argument\n\n");
+		printf("Example: replay /home/user/.isscrolls/history\n");
+		return;
+	}
+
+	if (replaying) {
+		printf("Cannot replay from within a replay\n");
+		return;
+	}
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		printf("Cannot open %s\n", file);
+		return;
+	}
+
+	replaying = 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (getline(&line, &size, fp) != -1) {
+		res = stripwhite(line);
+		if (*res == '\0' || *res == '#')
+			continue;
+		execute_command(res);
+		n++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	replaying = 0;
+
+	free(line);
+	fclose(fp);
+
+	ms = (end.tv_sec - start.tv_sec) * 1e3 +
+		(end.tv_nsec - start.tv_nsec) / 1e6;
+	printf("Replayed %zu commands in %.3f ms\n", n, ms);
 }
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Random numbers for all dice.  The generator is xoshiro256** by Blackman and
+ * Vigna, its state is seeded with splitmix64.  Dice are rolled without the
+ * bias of a plain modulo with Lemire's multiply and reject method.
+ *
+ * All roll_* functions use the current generator.  It is the one of the
+ * session unless a character is loaded or a caller, e.g. a simulation,
+ * switches to its own state.  A generator remembers its seed and how many
+ * numbers it produced, both together are enough to restore it.  Replaying
+ * takes as long as the dice did, so saved generators also keep their state.
+ *
+ * Instead of the generators, the dice can come from the kernel.  The bytes
+ * are read into a pool in chunks of ENTROPY_CHUNK, so most dice cost no
+ * system call, and bounded the same way.  Those dice cannot be replayed.
+ */
+
+#include <sys/param.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "isscrolls.h"
+
+#define ENTROPY_CHUNK	4096
+
+static struct dice_rng session_rng;
+static struct dice_rng *current_rng = &session_rng;
+static enum dice_source source = DICE_PRNG;
+
+static struct {
+	uint8_t	buf[ENTROPY_CHUNK];
+	size_t	pos;
+	size_t	len;
+	size_t	chunk;		/* bytes read at once */
+} pool = { .chunk = ENTROPY_CHUNK };
+
+static inline uint64_t
+rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/* splitmix64, advances *state and returns the next output */
+uint64_t
+rng_splitmix(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+void
+rng_seed(struct dice_rng *r, uint64_t seed)
+{
+	int i;
+
+	r->seed = seed;
+	r->pos = 0;
+	for (i = 0; i < 4; i++)
+		r->s[i] = rng_splitmix(&seed);
+}
+
+/* Restore a generator to the state after pos numbers */
+void
+rng_restore(struct dice_rng *r, uint64_t seed, uint64_t pos)
+{
+	rng_seed(r, seed);
+	while (r->pos < pos)
+		rng_next(r);
+}
+
+/* Restore a saved state, the seed and pos are kept for display and replay */
+int
+rng_set_state(struct dice_rng *r, uint64_t seed, uint64_t pos,
+    const uint64_t *s)
+{
+	/* The all zero state is a fixed point of the generator */
+	if ((s[0] | s[1] | s[2] | s[3]) == 0)
+		return -1;
+
+	memcpy(r->s, s, sizeof(r->s));
+	r->seed = seed;
+	r->pos = pos;
+
+	return 0;
+}
+
+uint64_t
+rng_next(struct dice_rng *r)
+{
+	uint64_t *s = r->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	r->pos++;
+
+	return result;
+}
+
+/* Uniform number in 0..n-1, n must not be 0 */
+uint32_t
+rng_below(struct dice_rng *r, uint32_t n)
+{
+	uint64_t m;
+	uint32_t l, t;
+
+	m = (rng_next(r) >> 32) * n;
+	l = (uint32_t)m;
+	if (l < n) {
+		t = -n % n;
+		while (l < t) {
+			m = (rng_next(r) >> 32) * n;
+			l = (uint32_t)m;
+		}
+	}
+
+	return m >> 32;
+}
+
+/*
+ * Seed the generator of the session with the given seed or, if there is
+ * none, from the system's entropy
+ */
+void
+init_dice_rng(const uint64_t *seed)
+{
+	uint64_t s;
+
+	if (seed != NULL)
+		s = *seed;
+	else if (getentropy(&s, sizeof(s)) == -1) {
+		log_debug("getentropy failed, seeding with the time\n");
+		s = ((uint64_t)time(NULL) << 32) ^ getpid();
+	}
+
+	rng_seed(&session_rng, s);
+	log_debug("Dice seed %llu\n", (unsigned long long)s);
+}
+
+struct dice_rng *
+get_dice_rng()
+{
+	return current_rng;
+}
+
+/* Switch to another generator, NULL switches back to the one of the session */
+void
+set_dice_rng(struct dice_rng *r)
+{
+	current_rng = r != NULL ? r : &session_rng;
+}
+
+static void
+fill_pool(void)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < pool.chunk) {
+#if defined(__OpenBSD__)
+		arc4random_buf(pool.buf, pool.chunk);
+		ret = pool.chunk;
+#elif defined(__linux__)
+		if ((ret = getrandom(pool.buf + done, pool.chunk - done, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			log_errx(1, "getrandom: %s\n", strerror(errno));
+		}
+#else
+		ret = MIN(pool.chunk - done, 256);
+		if (getentropy(pool.buf + done, ret) == -1)
+			log_errx(1, "getentropy: %s\n", strerror(errno));
+#endif
+		done += ret;
+	}
+
+	pool.pos = 0;
+	pool.len = pool.chunk;
+}
+
+static uint32_t
+entropy32(void)
+{
+	uint32_t x;
+
+	if (pool.len - pool.pos < sizeof(x))
+		fill_pool();
+	memcpy(&x, pool.buf + pool.pos, sizeof(x));
+	pool.pos += sizeof(x);
+
+	return x;
+}
+
+/* Uniform number in 0..n-1 from the kernel, like rng_below() */
+static uint32_t
+entropy_below(uint32_t n)
+{
+	uint64_t m;
+	uint32_t l, t;
+
+	m = (uint64_t)entropy32() * n;
+	l = (uint32_t)m;
+	if (l < n) {
+		t = -n % n;
+		while (l < t) {
+			m = (uint64_t)entropy32() * n;
+			l = (uint32_t)m;
+		}
+	}
+
+	return m >> 32;
+}
+
+/* Uniform number in 0..n-1 for a die, n must not be 0 */
+uint32_t
+dice_below(uint32_t n)
+{
+	if (source == DICE_ENTROPY)
+		return entropy_below(n);
+
+	return rng_below(current_rng, n);
+}
+
+/* Roll all dice with the generators or from the kernel */
+void
+set_dice_source(enum dice_source which)
+{
+	source = which;
+	/* Bytes of another process, e.g. before a fork, must not be reused */
+	pool.pos = pool.len = 0;
+}
+
+enum dice_source
+get_dice_source()
+{
+	return source;
+}
+
+/* Bytes read from the kernel at once, for benchmarks */
+void
+set_entropy_chunk(size_t chunk)
+{
+	pool.chunk = MAX(sizeof(uint32_t), MIN(chunk, sizeof(pool.buf)));
+	pool.pos = pool.len = 0;
+}
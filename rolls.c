@@ -14,6 +14,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <ctype.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
@@ -25,6 +26,8 @@
 
 #define MAXTOKENS 3
 
+static int last_roll = 0;
+
 static const char *odds[] = {
 	"Almost certain",
 	"Likely",
@@ -551,37 +554,82 @@ cmd_roll_challenge_die(__attribute__((unused)) char *unused)
 }
 
 void
-cmd_roll_oracle_die(__attribute__((unused)) char *unused)
+cmd_roll_oracle_die(char *table)
 {
+	if (table != NULL && strlen(table) > 0) {
+		cmd_roll_oracle_table(table);
+		return;
+	}
+
 	printf("<%ld>\n", roll_oracle_die());
 }
 
 long
 roll_action_die()
 {
-	long ret = random() % 6;
+	long die = dice_below(6) + 1;
 
-	return ret == 0 ? 6 : ret;
+	audit_roll(6, die);
+	return die;
 }
 
+/* 0 stands for 10, which makes it easy to read two of them as percentage */
 long
 roll_challenge_die()
 {
-	return random() % 10;
+	long die = dice_below(10);
+
+	audit_roll(10, die == 0 ? 10 : die);
+	return die;
 }
 
 long
 roll_oracle_die()
 {
-	return random() % 100;
+	long die = dice_below(100);
+
+	audit_roll(100, die == 0 ? 100 : die);
+	return die;
+}
+
+/* Roll a die with the given number of sides, the result is 1..sides */
+long
+roll_die(long sides)
+{
+	long die = dice_below(sides) + 1;
+
+	audit_roll(sides, die);
+	return die;
+}
+
+/* Compare case insensitive and ignore the spaces of a */
+static int
+same_without_spaces(const char *a, const char *b)
+{
+	for (; *a != '\0'; a++) {
+		if (*a == ' ')
+			continue;
+		if (tolower((unsigned char)*a) != tolower((unsigned char)*b))
+			return 0;
+		b++;
+	}
+
+	return *b == '\0';
 }
 
 void
 cmd_yes_or_no(char *args)
 {
-	int num = atoi(args);
+	int num = 0;
 	int i;
 
+	/* The odds can be named without spaces, e.g. almostcertain */
+	for (i = 0; num == 0 && odds[i] != NULL; i++)
+		if (same_without_spaces(odds[i], args))
+			num = i + 1;
+	if (num == 0)
+		num = atoi(args);
+
 	log_debug("Argument %d\n", num);
 	if (num <= 0 || num > 5) {
 		printf("Provide a number between 1-5 as argument, i.e. yesorno 2\n\n");
@@ -623,6 +671,13 @@ yes_or_no(int num)
 		pm(RED, "no\n");
 }
 
+/* Outcome of the last action or progress roll, 8, 4 or 2 */
+int
+get_last_roll()
+{
+	return last_roll;
+}
+
 int
 action_roll(int args[2])
 {
@@ -635,6 +690,8 @@ action_roll(int args[2])
 		log_errx(1, "No attribute value provided. This should not happen!");
 	}
 
+	print_roll_odds(action_odds(args[0] + (args[1] != -1 ? args[1] : 0)));
+
 	a1 = b = roll_action_die();
 	/* Add attribute and maybe a bonus value */
 	b += args[0];
@@ -668,6 +725,7 @@ action_roll(int args[2])
 		ret = 8;
 	}
 
+	last_roll = ret;
 	return ret;
 }
 
@@ -693,6 +751,8 @@ progress_roll(double args[2])
 	if (args[1] != -1)
 		b += args[1];
 
+	print_roll_odds(progress_odds(b));
+
 	if (c1 == c2) {
 			printf("D10: <%ld> match vs ", c1);
 	} else {
@@ -712,6 +772,7 @@ progress_roll(double args[2])
 		ret = 8;
 	}
 
+	last_roll = ret;
 	return ret;
 }
 
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Play many scripted fights, journeys or delves with a copy of the current
+ * character and count how they end.  The encounters run the same move
+ * commands as the player does.  Those use the current character, the current
+ * dice and stdout of the process, so every worker is a process of its own: it
+ * owns a copy of the character, rolls with its own generator, writes the
+ * output of the moves to /dev/null and never saves anything.  A worker sends
+ * its counts back over a pipe when it is done.
+ *
+ * The script of an encounter is simple.  Moves are made with the best stat
+ * until the progress move hits with SIMULATE_TARGET percent, then the
+ * progress move is rolled.  In a fight, the character strikes with initiative
+ * and clashes without, every miss is paid by enduring harm and at 0 health
+ * the character faces death.
+ */
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "isscrolls.h"
+
+#define SIMULATE_DEFAULT	100000
+#define SIMULATE_MAX_WORKERS	64
+#define SIMULATE_MAX_MOVES	500
+#define SIMULATE_ROWS		30
+#define SIMULATE_TARGET		75
+#define SIMULATE_BAR		40
+
+enum sim_kind {
+	SIM_JOURNEY,
+	SIM_FIGHT,
+	SIM_DELVE,
+};
+
+enum sim_outcome {
+	SIM_STRONG,
+	SIM_WEAK,
+	SIM_MISS,
+	SIM_DEAD,
+	SIM_UNFINISHED,
+	SIM_OUTCOMES,
+};
+
+struct sim_result {
+	uint64_t	encounters;
+	uint64_t	moves;
+	uint64_t	facedeath;	/* encounters with at least one face death */
+	uint64_t	outcome[SIM_OUTCOMES];
+	uint64_t	length[SIMULATE_MAX_MOVES + 1];	/* moves per encounter */
+	double		seconds;	/* CPU time of the worker */
+};
+
+/* A private copy of the character and its tracks */
+struct sim_character {
+	struct character	c;
+	struct journey		j;
+	struct fight		f;
+	struct delve		d;
+};
+
+struct sim_worker {
+	pid_t			pid;
+	int			fd;
+	struct sim_result	r;
+};
+
+static const char *kind_names[] = { "journey", "fight", "delve" };
+static const char *kind_plurals[] = { "journeys", "fights", "delves" };
+static const char *outcome_names[] = {
+	"strong hit", "weak hit", "miss", "dead", "unfinished"
+};
+
+static double
+elapsed(clockid_t clock, const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(clock, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+reset_character(struct sim_character *s, const struct character *tmpl)
+{
+	s->c = *tmpl;
+	s->j = *tmpl->j;
+	s->f = *tmpl->fight;
+	s->d = *tmpl->delve;
+
+	s->c.j = &s->j;
+	s->c.fight = &s->f;
+	s->c.delve = &s->d;
+	s->c.journey_active = s->c.fight_active = s->c.delve_active = 0;
+	s->j.progress = s->f.progress = s->d.progress = 0;
+	s->f.initiative = 0;
+}
+
+/* Run a move command like the player would, the command may modify args */
+static void
+move(void (*fn)(char *), const char *args)
+{
+	char buf[MAX_STAT_LEN];
+
+	snprintf(buf, sizeof(buf), "%s", args);
+	fn(buf);
+}
+
+/* The highest of the stats in names of the current character */
+static const char *
+best_stat(const char **names, int mask)
+{
+	const char *best = names[0];
+	int v, max = -1;
+
+	for (; *names != NULL; names++) {
+		if ((v = return_char_stat(*names, mask)) > max) {
+			max = v;
+			best = *names;
+		}
+	}
+
+	return best;
+}
+
+static int
+good_enough(double progress)
+{
+	const struct odds *o = progress_odds(progress);
+
+	return progress >= 10 ||
+		100 * (o->strong + o->weak) >= SIMULATE_TARGET * o->total;
+}
+
+static enum sim_outcome
+last_outcome(void)
+{
+	switch (get_last_roll()) {
+	case 8:
+		return SIM_STRONG;
+	case 4:
+		return SIM_WEAK;
+	default:
+		return SIM_MISS;
+	}
+}
+
+static enum sim_outcome
+simulate_fight(struct character *c, int rank, int *moves, int *facedeath)
+{
+	static const char *fray[] = { "heart", "shadow", "wits", NULL };
+	static const char *strike[] = { "iron", "edge", NULL };
+	const char *fstat, *sstat;
+
+	fstat = best_stat(fray, STAT_HEART|STAT_SHADOW|STAT_WITS);
+	sstat = best_stat(strike, STAT_IRON|STAT_EDGE);
+
+	set_next_answer(rank);
+	move(cmd_enter_the_fray, fstat);
+	for (*moves = 1; *moves < SIMULATE_MAX_MOVES; ) {
+		if (get_last_roll() == 2) {
+			/* Pay the price */
+			move(cmd_endure_harm, "");
+			(*moves)++;
+			if (c->health == 0) {
+				*facedeath = 1;
+				move(cmd_face_death, "");
+				(*moves)++;
+				if (c->dead)
+					return SIM_DEAD;
+			}
+		}
+
+		if (good_enough(c->fight->progress)) {
+			move(cmd_end_the_fight, "");
+			(*moves)++;
+			return last_outcome();
+		}
+
+		move(c->fight->initiative ? cmd_strike : cmd_clash, sstat);
+		(*moves)++;
+	}
+
+	return SIM_UNFINISHED;
+}
+
+static enum sim_outcome
+simulate_journey(struct character *c, int rank, int *moves)
+{
+	set_next_answer(rank);
+	move(cmd_undertake_a_journey, "");
+	for (*moves = 1; *moves < SIMULATE_MAX_MOVES; (*moves)++) {
+		if (good_enough(c->j->progress)) {
+			/* End the journey if the destination is not reached */
+			set_next_answer(1);
+			move(cmd_reach_your_destination, "");
+			(*moves)++;
+			return last_outcome();
+		}
+		move(cmd_undertake_a_journey, "");
+	}
+
+	return SIM_UNFINISHED;
+}
+
+static enum sim_outcome
+simulate_delve(struct character *c, int rank, int *moves)
+{
+	static const char *delve[] = { "wits", "shadow", "edge", NULL };
+	const char *stat;
+
+	stat = best_stat(delve, STAT_WITS|STAT_SHADOW|STAT_EDGE);
+
+	set_next_answer(rank);
+	move(cmd_discover_a_site, "");
+	for (*moves = 0; *moves < SIMULATE_MAX_MOVES; (*moves)++) {
+		if (good_enough(c->delve->progress)) {
+			/* End the delve if the objective is not located */
+			set_next_answer(1);
+			move(cmd_locate_your_objective, "");
+			(*moves)++;
+			return last_outcome();
+		}
+		move(cmd_delve_the_depths, stat);
+	}
+
+	return SIM_UNFINISHED;
+}
+
+static void __attribute__((noreturn))
+run_worker(int fd, enum sim_kind kind, int rank, uint64_t n, uint64_t seed)
+{
+	const struct character *tmpl = get_current_character();
+	struct sim_character s;
+	struct sim_result r;
+	struct dice_rng rng;
+	struct timespec start;
+	enum sim_outcome o = SIM_UNFINISHED;
+	const char *p;
+	size_t left;
+	ssize_t ret;
+	int moves, facedeath;
+
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		_exit(1);
+	disable_saving();
+
+	rng_seed(&rng, seed);
+	set_dice_rng(&rng);
+	/* Drop the kernel bytes of the parent, every worker reads its own */
+	set_dice_source(get_dice_source());
+	memset(&r, 0, sizeof(r));
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	for (r.encounters = 0; r.encounters < n; r.encounters++) {
+		reset_character(&s, tmpl);
+		set_current_character(&s.c);
+
+		moves = facedeath = 0;
+		switch (kind) {
+		case SIM_JOURNEY:
+			o = simulate_journey(&s.c, rank, &moves);
+			break;
+		case SIM_FIGHT:
+			o = simulate_fight(&s.c, rank, &moves, &facedeath);
+			break;
+		case SIM_DELVE:
+			o = simulate_delve(&s.c, rank, &moves);
+			break;
+		}
+
+		r.outcome[o]++;
+		r.moves += moves;
+		r.facedeath += facedeath;
+		r.length[MIN(moves, SIMULATE_MAX_MOVES)]++;
+	}
+	fflush(stdout);
+	r.seconds = elapsed(CLOCK_PROCESS_CPUTIME_ID, &start);
+
+	for (p = (const char *)&r, left = sizeof(r); left > 0;
+	    p += ret, left -= ret) {
+		if ((ret = write(fd, p, left)) == -1) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			_exit(1);
+		}
+	}
+
+	_exit(0);
+}
+
+static int
+read_worker(struct sim_worker *w)
+{
+	char *p;
+	size_t left;
+	ssize_t ret;
+	int status;
+
+	for (p = (char *)&w->r, left = sizeof(w->r); left > 0;
+	    p += ret, left -= ret) {
+		if ((ret = read(w->fd, p, left)) == -1 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret <= 0)
+			break;
+	}
+	close(w->fd);
+
+	while (waitpid(w->pid, &status, 0) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	if (left > 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+
+	return 0;
+}
+
+/* Histogram of the moves per encounter in at most SIMULATE_ROWS rows */
+static void
+print_lengths(const uint64_t *length, uint64_t total)
+{
+	uint64_t row, max = 0;
+	int lo = -1, hi = 0, width, b, i;
+
+	for (b = 0; b <= SIMULATE_MAX_MOVES; b++) {
+		if (length[b] == 0)
+			continue;
+		if (lo == -1)
+			lo = b;
+		hi = b;
+	}
+	width = (hi - lo) / SIMULATE_ROWS + 1;
+
+	for (b = lo; b <= hi; b += width) {
+		for (row = 0, i = b; i < b + width && i <= hi; i++)
+			row += length[i];
+		max = MAX(max, row);
+	}
+
+	for (b = lo; b <= hi; b += width) {
+		for (row = 0, i = b; i < b + width && i <= hi; i++)
+			row += length[i];
+		if (width == 1)
+			printf("%8d", b);
+		else
+			printf("%4d-%-3d", b, MIN(b + width - 1, hi));
+		printf(" %7.3f%% ", 100.0 * row / total);
+		for (i = 0; i < (int)(SIMULATE_BAR * row / max); i++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+static void
+print_results(enum sim_kind kind, int rank, const struct sim_worker *w,
+	int nworkers, double wall)
+{
+	struct sim_result total;
+	double busy = 0;
+	int i, b;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nworkers; i++) {
+		total.encounters += w[i].r.encounters;
+		total.moves += w[i].r.moves;
+		total.facedeath += w[i].r.facedeath;
+		for (b = 0; b < SIM_OUTCOMES; b++)
+			total.outcome[b] += w[i].r.outcome[b];
+		for (b = 0; b <= SIMULATE_MAX_MOVES; b++)
+			total.length[b] += w[i].r.length[b];
+		busy += w[i].r.seconds;
+	}
+
+	printf("Simulated %llu %s of rank %d with %d workers in %.3fs\n\n",
+		(unsigned long long)total.encounters, kind_plurals[kind], rank,
+		nworkers, wall);
+
+	for (b = 0; b < SIM_OUTCOMES; b++) {
+		if (b == SIM_DEAD && kind != SIM_FIGHT)
+			continue;
+		printf("%-12s %7.3f%% %12llu\n", outcome_names[b],
+			100.0 * total.outcome[b] / total.encounters,
+			(unsigned long long)total.outcome[b]);
+	}
+	if (kind == SIM_FIGHT)
+		printf("Faced death in %.3f%% of the fights\n",
+			100.0 * total.facedeath / total.encounters);
+
+	printf("\nMoves per %s, %.2f on average\n", kind_names[kind],
+		(double)total.moves / total.encounters);
+	print_lengths(total.length, total.encounters);
+
+	printf("\nWorker %12s %10s %12s\n", kind_plurals[kind], "CPU time",
+		"per second");
+	for (i = 0; i < nworkers; i++)
+		printf("%6d %12llu %10.3f %12.0f\n", i,
+			(unsigned long long)w[i].r.encounters, w[i].r.seconds,
+			w[i].r.encounters / w[i].r.seconds);
+	printf("\n%.0f %s and %.0f moves per second\n", total.encounters / wall,
+		kind_plurals[kind], total.moves / wall);
+	printf("Speedup %.2f with %d workers, %.0f%% efficiency\n", busy / wall,
+		nworkers, 100.0 * busy / wall / nworkers);
+}
+
+static void
+simulate_usage(void)
+{
+	printf("Please provide what to simulate, its rank and optionally the "\
+		"number of\nencounters and workers\n\n");
+	printf("> simulate <journey|fight|delve> <rank> [encounters] [workers]\n\n");
+	printf("Example: simulate fight 2 1000000\n");
+}
+
+void
+cmd_simulate(char *cmd)
+{
+	struct character *curchar = get_current_character();
+	struct sim_worker *workers;
+	struct timespec start;
+	enum sim_kind kind;
+	char *tokens[5] = { NULL };
+	char *p, *last, *ep;
+	long long n = SIMULATE_DEFAULT, per;
+	uint64_t seed;
+	long nworkers, rank;
+	int i, fds[2], failed = 0;
+
+	CURCHAR_CHECK();
+
+	i = 0;
+	for ((p = strtok_r(cmd, " ", &last)); p;
+	    (p = strtok_r(NULL, " ", &last))) {
+		if (i < 4)
+			tokens[i++] = p;
+	}
+
+	if (tokens[0] == NULL || tokens[1] == NULL) {
+		simulate_usage();
+		return;
+	}
+
+	if (strcasecmp(tokens[0], "journey") == 0)
+		kind = SIM_JOURNEY;
+	else if (strcasecmp(tokens[0], "fight") == 0)
+		kind = SIM_FIGHT;
+	else if (strcasecmp(tokens[0], "delve") == 0)
+		kind = SIM_DELVE;
+	else {
+		simulate_usage();
+		return;
+	}
+
+	errno = 0;
+	rank = strtol(tokens[1], &ep, 10);
+	if (*ep != '\0' || errno == ERANGE || rank < 1 || rank > 5) {
+		printf("Please provide a rank between 1 and 5\n");
+		return;
+	}
+
+	if (tokens[2] != NULL) {
+		errno = 0;
+		n = strtoll(tokens[2], &ep, 10);
+		if (*ep != '\0' || errno == ERANGE || n < 1 || n > 1000000000LL) {
+			printf("Please provide between 1 and 1000000000 encounters\n");
+			return;
+		}
+	}
+
+	if (tokens[3] != NULL) {
+		errno = 0;
+		nworkers = strtol(tokens[3], &ep, 10);
+		if (*ep != '\0' || errno == ERANGE || nworkers < 1 ||
+		    nworkers > SIMULATE_MAX_WORKERS) {
+			printf("Please provide between 1 and %d workers\n",
+				SIMULATE_MAX_WORKERS);
+			return;
+		}
+	} else if ((nworkers = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nworkers = 1;
+	nworkers = MIN(nworkers, MIN(n, SIMULATE_MAX_WORKERS));
+
+	/* Every worker gets its own stream, all follow from the current dice */
+	seed = rng_next(get_dice_rng());
+	log_debug("Simulation seed %llu\n", (unsigned long long)seed);
+
+	if ((workers = calloc(nworkers, sizeof(*workers))) == NULL)
+		log_errx(1, "calloc");
+
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nworkers; i++) {
+		per = n / nworkers + (i < n % nworkers ? 1 : 0);
+		if (pipe(fds) == -1)
+			log_errx(1, "pipe");
+		switch ((workers[i].pid = fork())) {
+		case -1:
+			log_errx(1, "fork");
+			break;
+		case 0:
+			close(fds[0]);
+			run_worker(fds[1], kind, rank, per, rng_splitmix(&seed));
+			break;
+		default:
+			rng_splitmix(&seed);
+			close(fds[1]);
+			workers[i].fd = fds[0];
+			break;
+		}
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		if (read_worker(&workers[i]) == -1) {
+			printf("Worker %d failed\n", i);
+			failed = 1;
+		}
+	}
+
+	if (!failed)
+		print_results(kind, rank, workers, nworkers,
+		    elapsed(CLOCK_MONOTONIC, &start));
+
+	free(workers);
+}
@@ -0,0 +1,709 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "isscrolls.h"
+
+#include <json-c/json.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The oracle tables parsed from the JSON files.  Every entry and every table
+ * name is stored once in a single string arena, the tables only keep offsets
+ * and lengths.  A table has a row for each possible roll, indexed by the upper
+ * bound of the "Chance" range of each entry.  Rows without an entry point to
+ * the empty string at the start of the arena.
+ */
+struct oracle_row {
+	uint32_t	off;
+	uint32_t	len;
+};
+
+struct oracle_array {
+	uint32_t	name;
+	int		nrows;
+	size_t		first;
+};
+
+static struct {
+	char			*buf;
+	size_t			 len;
+	size_t			 size;
+	struct oracle_row	*rows;
+	size_t			 nrows;
+	size_t			 maxrows;
+	struct oracle_array	*arrays;
+	size_t			 narrays;
+	size_t			 maxarrays;
+} arena;
+
+/*
+ * Tables that have their own command.  Every other table is only reachable
+ * through its name with the oracle command.
+ */
+static const char *oracle_paths[ORACLE_MAX] = {
+	[ORACLE_IS_NAMES]		= "names/ironlander",
+	[ORACLE_ELF_NAMES]		= "names/elf",
+	[ORACLE_GIANT_NAMES]		= "names/giant",
+	[ORACLE_VAROU_NAMES]		= "names/varou",
+	[ORACLE_TROLL_NAMES]		= "names/troll",
+	[ORACLE_ACTIONS]		= "prompts/action",
+	[ORACLE_THEMES]			= "prompts/theme",
+	[ORACLE_RANKS]			= "turning-point/challenge-rank",
+	[ORACLE_COMBAT_ACTIONS]		= "turning-point/combat-action",
+	[ORACLE_PLOT_TWISTS]		= "turning-point/major-plot-twist",
+	[ORACLE_MYSTIC_BACKSLASH]	= "turning-point/mystic-backlash",
+	[ORACLE_REGION]			= "place/region",
+	[ORACLE_LOCATION]		= "place/location",
+	[ORACLE_COASTAL]		= "place/coastal-waters-location",
+	[ORACLE_DESCRIPTION]		= "place/location-descriptors",
+	[ORACLE_PAYTHEPRICE]		= "move/pay-the-price",
+	[ORACLE_DELVE_THE_DEPTHS_EDGE]	= "move/delve-the-depths-edge",
+	[ORACLE_DELVE_THE_DEPTHS_SHADOW] = "move/delve-the-depths-shadow",
+	[ORACLE_DELVE_THE_DEPTHS_WITS]	= "move/delve-the-depths-wits",
+	[ORACLE_DELVE_OPPORTUNITY]	= "move/find-an-opportunity",
+	[ORACLE_DELVE_DANGER]		= "move/reveal-a-danger",
+	[ORACLE_CHAR_ROLE]		= "character/role",
+	[ORACLE_CHAR_GOAL]		= "character/goal",
+	[ORACLE_CHAR_DESC]		= "character/descriptor",
+	[ORACLE_CHAR_DISPOSITION]	= "character/disposition",
+	[ORACLE_CHAR_ACTIVITY]		= "character/activity",
+};
+
+static const char *oracle_dir = PATH_SHARE_DIR;
+static const char *override_dir = NULL;
+
+static struct oracle_source *sources = NULL;
+static size_t nsources = 0;
+
+typedef void (*oracle_visit)(const char *, json_object *, int);
+
+static void walk_oracles(json_object *, const char *, const char *,
+	oracle_visit);
+
+/* What check_oracle_file() compares against and the first mismatch */
+static const struct oracle_table *(*check_lookup)(const char *);
+static char *check_err;
+static size_t check_errlen;
+static int check_failed;
+
+/* Copy a string into the arena and return its offset */
+static uint32_t
+arena_add(const char *s, size_t len)
+{
+	size_t off;
+	char *p;
+
+	if (arena.len + len + 1 > arena.size) {
+		size_t size = arena.size ? arena.size : 4096;
+
+		while (arena.len + len + 1 > size)
+			size *= 2;
+		if (size > UINT32_MAX)
+			log_errx(1, "Oracle string arena is full\n");
+		if ((p = realloc(arena.buf, size)) == NULL)
+			log_errx(1, "realloc");
+		arena.buf = p;
+		arena.size = size;
+	}
+
+	off = arena.len;
+	memcpy(arena.buf + off, s, len);
+	arena.buf[off + len] = '\0';
+	arena.len += len + 1;
+
+	return off;
+}
+
+/* Add an empty table with the given name and number of rows */
+static struct oracle_array *
+arena_add_array(const char *name, int nrows)
+{
+	struct oracle_array *a;
+	struct oracle_row *r;
+	size_t max;
+
+	if (arena.len == 0)
+		arena_add("", 0);
+
+	if (arena.narrays == arena.maxarrays) {
+		max = arena.maxarrays ? arena.maxarrays * 2 : 64;
+		if ((a = reallocarray(arena.arrays, max, sizeof(*a))) == NULL)
+			log_errx(1, "reallocarray");
+		arena.arrays = a;
+		arena.maxarrays = max;
+	}
+
+	if (arena.nrows + nrows > arena.maxrows) {
+		max = arena.maxrows ? arena.maxrows : 1024;
+		while (arena.nrows + nrows > max)
+			max *= 2;
+		if ((r = reallocarray(arena.rows, max, sizeof(*r))) == NULL)
+			log_errx(1, "reallocarray");
+		arena.rows = r;
+		arena.maxrows = max;
+	}
+
+	a = &arena.arrays[arena.narrays++];
+	a->name = arena_add(name, strlen(name));
+	a->nrows = nrows;
+	a->first = arena.nrows;
+	memset(&arena.rows[a->first], 0, nrows * sizeof(*arena.rows));
+	arena.nrows += nrows;
+
+	return a;
+}
+
+static void
+add_to_array(struct oracle_array *a, int id, const char *value)
+{
+	struct oracle_row *r;
+	size_t len;
+
+	log_debug("%s, %d, %s\n", arena.buf + a->name, id, value);
+
+	if (id < 0 || id >= a->nrows || value == NULL)
+		return;
+
+	len = strlen(value);
+	r = &arena.rows[a->first + id];
+	r->off = arena_add(value, len);
+	r->len = len;
+}
+
+/* Release all parsed tables in one go */
+void
+free_oracle_arrays()
+{
+	free(arena.buf);
+	free(arena.rows);
+	free(arena.arrays);
+	memset(&arena, 0, sizeof(arena));
+}
+
+size_t
+oracle_array_count()
+{
+	return arena.narrays;
+}
+
+const char *
+oracle_array_name(size_t n)
+{
+	if (n >= arena.narrays)
+		return "";
+
+	return arena.buf + arena.arrays[n].name;
+}
+
+int
+oracle_array_rows(size_t n)
+{
+	if (n >= arena.narrays)
+		return 0;
+
+	return arena.arrays[n].nrows;
+}
+
+const char *
+oracle_array_row(size_t n, int id)
+{
+	if (n >= arena.narrays || id < 0 || id >= arena.arrays[n].nrows)
+		return "";
+
+	return arena.buf + arena.rows[arena.arrays[n].first + id].off;
+}
+
+size_t
+oracle_array_row_len(size_t n, int id)
+{
+	if (n >= arena.narrays || id < 0 || id >= arena.arrays[n].nrows)
+		return 0;
+
+	return arena.rows[arena.arrays[n].first + id].len;
+}
+
+/*
+ * Map every roll from 1 to dice to the entry whose "Chance" range covers it.
+ * The entries have to be sorted by their upper bound.  Fails if a roll is not
+ * covered by any entry.
+ */
+int
+build_oracle_index(const struct oracle_entry *e, uint32_t n, uint16_t *index,
+	uint32_t dice)
+{
+	uint32_t roll, i = 0;
+
+	index[0] = 0;
+	for (roll = 1; roll <= dice; roll++) {
+		while (i < n && e[i].high < roll)
+			i++;
+		if (i == n || e[i].low > roll)
+			return -1;
+		index[roll] = i;
+	}
+
+	return 0;
+}
+
+/*
+ * Turn a name from the JSON files into a path component.  "Coastal Waters
+ * Location" becomes "coastal-waters-location".  If strip is given, it is
+ * removed from the start or the end, so "Settlement Name" in the settlement
+ * file becomes "name".
+ */
+void
+normalize_name(const char *name, const char *strip, char *buf, size_t len)
+{
+	size_t n = 0, slen;
+	int dash = 0;
+
+	for (; *name != '\0' && n + 1 < len; name++) {
+		if (isalnum((unsigned char)*name)) {
+			if (dash && n > 0)
+				buf[n++] = '-';
+			if (n + 1 < len)
+				buf[n++] = tolower((unsigned char)*name);
+			dash = 0;
+		} else
+			dash = 1;
+	}
+	buf[n] = '\0';
+
+	if (strip == NULL || (slen = strlen(strip)) == 0 || n <= slen + 1)
+		return;
+
+	if (strncmp(buf, strip, slen) == 0 && buf[slen] == '-')
+		memmove(buf, buf + slen + 1, n - slen);
+	else if (strcmp(buf + n - slen, strip) == 0 && buf[n - slen - 1] == '-')
+		buf[n - slen - 1] = '\0';
+}
+
+static void
+join_path(char *buf, size_t len, const char *path, const char *name)
+{
+	int ret;
+
+	ret = snprintf(buf, len, "%s/%s", path, name);
+	if (ret < 0 || (size_t)ret >= len) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", buf);
+	}
+}
+
+/*
+ * Add one "Oracle Table" under the given path.  Entries that come with their
+ * own table, such as the kinds of settlement names, add it as a sub table.
+ */
+/* Without a "d" field the die is given by the largest "Chance" */
+static int
+table_dice(json_object *table, int dice)
+{
+	json_object *temp, *chance;
+	size_t n_entries, j;
+
+	if (dice > 0)
+		return dice;
+
+	n_entries = json_object_array_length(table);
+	for (j = 0; j < n_entries; j++) {
+		temp = json_object_array_get_idx(table, j);
+		if (json_object_object_get_ex(temp, "Chance", &chance) &&
+		    json_object_get_int(chance) > dice)
+			dice = json_object_get_int(chance);
+	}
+
+	return dice;
+}
+
+static void
+add_oracle_table(const char *path, json_object *table, int dice)
+{
+	char sub[_POSIX_PATH_MAX], name[NAME_MAX];
+	json_object *temp, *desc, *chance, *subtable;
+	struct oracle_array *a;
+	size_t n_entries, j;
+	int id;
+
+	n_entries = json_object_array_length(table);
+
+	dice = table_dice(table, dice);
+	if (dice <= 0 || dice > UINT16_MAX) {
+		log_debug("Skip oracle table %s\n", path);
+		return;
+	}
+
+	a = arena_add_array(path, dice + 1);
+	for (j = 0; j < n_entries; j++) {
+		temp = json_object_array_get_idx(table, j);
+		if (!json_object_object_get_ex(temp, "Description", &desc) ||
+		    !json_object_object_get_ex(temp, "Chance", &chance))
+			continue;
+		id = json_object_get_int(chance);
+		add_to_array(a, id, json_object_get_string(desc));
+
+		if (json_object_object_get_ex(temp, "Oracle Table", &subtable)) {
+			normalize_name(json_object_get_string(desc), NULL, name,
+				sizeof(name));
+			join_path(sub, sizeof(sub), path, name);
+			add_oracle_table(sub, subtable, 0);
+		}
+	}
+}
+
+static void
+check_mismatch(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (check_failed++)
+		return;
+
+	va_start(ap, fmt);
+	vsnprintf(check_err, check_errlen, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * Check every roll of a parsed table against the "Chance" ranges of the
+ * JSON.  An entry covers the rolls above the "Chance" of the entry before it
+ * up to its own.
+ */
+static void
+check_oracle_table(const char *path, json_object *table, int dice)
+{
+	char sub[_POSIX_PATH_MAX], name[NAME_MAX];
+	json_object *temp, *desc, *chance, *subtable;
+	const struct oracle_table *t;
+	const struct oracle_entry *e;
+	const char *text;
+	size_t n_entries, j;
+	int roll, low = 1, high;
+
+	n_entries = json_object_array_length(table);
+
+	dice = table_dice(table, dice);
+	if (dice <= 0 || dice > UINT16_MAX)
+		return;
+
+	if ((t = check_lookup(path)) == NULL) {
+		check_mismatch("Missing oracle table %s", path);
+		return;
+	}
+	if (t->dice != (uint32_t)dice) {
+		check_mismatch("%s: d%u instead of d%d", path, t->dice, dice);
+		return;
+	}
+
+	for (j = 0; j < n_entries; j++) {
+		temp = json_object_array_get_idx(table, j);
+		if (!json_object_object_get_ex(temp, "Description", &desc) ||
+		    !json_object_object_get_ex(temp, "Chance", &chance))
+			continue;
+		text = json_object_get_string(desc);
+		high = json_object_get_int(chance);
+		if (text == NULL || *text == '\0')
+			continue;
+
+		for (roll = low; roll <= high && roll <= dice; roll++) {
+			e = &t->entries[t->index[roll]];
+			if (e->low > roll || e->high < roll ||
+			    strcmp(t->strings + e->str, text) != 0)
+				check_mismatch("%s: roll %d is \"%s\" instead of "
+					"\"%s\"", path, roll, t->strings + e->str,
+					text);
+		}
+		if (high >= low)
+			low = high + 1;
+
+		if (json_object_object_get_ex(temp, "Oracle Table", &subtable)) {
+			normalize_name(text, NULL, name, sizeof(name));
+			join_path(sub, sizeof(sub), path, name);
+			check_oracle_table(sub, subtable, 0);
+		}
+	}
+
+	if (low <= dice)
+		check_mismatch("%s: rolls from %d are not in the JSON", path, low);
+}
+
+/*
+ * Walk an "Oracles" or "Categories" array.  Each element has a name and can
+ * have an "Oracle Table", further "Oracles" or both.
+ */
+static void
+walk_oracles(json_object *oracles, const char *path, const char *strip,
+	oracle_visit visit)
+{
+	char sub[_POSIX_PATH_MAX], name[NAME_MAX];
+	json_object *temp, *jname, *table, *d;
+	size_t n_oracles, i;
+
+	n_oracles = json_object_array_length(oracles);
+
+	log_debug("number of oracles: %d\n", n_oracles);
+	for (i = 0; i < n_oracles; i++) {
+		temp = json_object_array_get_idx(oracles, i);
+		if (!json_object_object_get_ex(temp, "Name", &jname))
+			continue;
+		log_debug("Name %s\n", json_object_get_string(jname));
+
+		normalize_name(json_object_get_string(jname), strip, name,
+			sizeof(name));
+		join_path(sub, sizeof(sub), path, name);
+
+		if (json_object_object_get_ex(temp, "Oracle Table", &table)) {
+			d = NULL;
+			json_object_object_get_ex(temp, "d", &d);
+			visit(sub, table, d ? json_object_get_int(d) : 0);
+		}
+
+		if (json_object_object_get_ex(temp, "Oracles", &table))
+			walk_oracles(table, sub, NULL, visit);
+	}
+}
+
+/* Walk all oracle tables of a JSON file, -1 if it cannot be read */
+static int
+walk_oracle_file(struct oracle_source *s, oracle_visit visit)
+{
+	char path[_POSIX_PATH_MAX];
+	json_object *root, *oracles;
+	int ret;
+
+	ret = snprintf(path, sizeof(path), "%s/%s", s->dir, s->file);
+	if (ret < 0 || (size_t)ret >= sizeof(path)) {
+		log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
+	}
+
+	if ((root = json_object_from_file(path)) == NULL) {
+		log_debug("Cannot open %s\n", path);
+		return -1;
+	}
+
+	if (json_object_object_get_ex(root, "Oracles", &oracles))
+		walk_oracles(oracles, s->prefix, s->prefix, visit);
+	else if (json_object_object_get_ex(root, "Categories", &oracles))
+		walk_oracles(oracles, s->prefix, s->prefix, visit);
+	else
+		log_debug("Cannot find a [Oracles] array in %s\n", path);
+
+	/* Decrement the reference count of json_object and free if it reaches zero. */
+	json_object_put(root);
+
+	return 0;
+}
+
+/*
+ * Parse all oracle tables of a JSON file into the arena.  Returns -1 if the
+ * file cannot be read or is not valid JSON.
+ */
+int
+read_oracle_file(struct oracle_source *s)
+{
+	return walk_oracle_file(s, add_oracle_table);
+}
+
+/*
+ * Check all rolls of the tables of a JSON file, which lookup finds by name,
+ * against the file.  Returns -1 and the first mismatch in err if a roll does
+ * not give the entry that the "Chance" ranges say.
+ */
+int
+check_oracle_file(struct oracle_source *s,
+	const struct oracle_table *(*lookup)(const char *), char *err,
+	size_t errlen)
+{
+	check_lookup = lookup;
+	check_err = err;
+	check_errlen = errlen;
+	check_failed = 0;
+
+	if (walk_oracle_file(s, check_oracle_table) == -1) {
+		snprintf(err, errlen, "Cannot read %s/%s", s->dir, s->file);
+		return -1;
+	}
+
+	return check_failed ? -1 : 0;
+}
+
+static int
+oracle_file_filter(const struct dirent *d)
+{
+	size_t len = strlen(d->d_name);
+
+	return len > 5 && strcmp(d->d_name + len - 5, ".json") == 0 &&
+		strstr(d->d_name, "oracles") != NULL;
+}
+
+static struct oracle_source *
+add_oracle_source(const char *dir, const char *file)
+{
+	struct oracle_source *s;
+	char *name, *p;
+	size_t i;
+
+	/* Files in the override directory replace the ones in the share dir */
+	for (i = 0; i < nsources; i++)
+		if (strcmp(sources[i].file, file) == 0)
+			return NULL;
+
+	if ((s = reallocarray(sources, nsources + 1, sizeof(*s))) == NULL)
+		log_errx(1, "reallocarray");
+	sources = s;
+	s = &sources[nsources++];
+	memset(s, 0, sizeof(*s));
+	s->dir = dir;
+	if ((s->file = strdup(file)) == NULL || (name = strdup(file)) == NULL)
+		log_errx(1, "strdup");
+
+	p = name;
+	if (strncmp(p, "ironsworn_", 10) == 0)
+		p += 10;
+	if (strncmp(p, "oracles_", 8) == 0)
+		p += 8;
+	p[strlen(p) - 5] = '\0';
+	if (strlen(p) > 8 && strcmp(p + strlen(p) - 8, "_oracles") == 0)
+		p[strlen(p) - 8] = '\0';
+	normalize_name(p, NULL, s->prefix, sizeof(s->prefix));
+	free(name);
+
+	log_debug("Oracle file %s/%s provides %s/\n", dir, file, s->prefix);
+
+	return s;
+}
+
+static void
+scan_oracle_dir(const char *dir)
+{
+	struct dirent **list;
+	int i, n;
+
+	if ((n = scandir(dir, &list, oracle_file_filter, alphasort)) == -1) {
+		log_debug("Cannot read %s\n", dir);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		add_oracle_source(dir, list[i]->d_name);
+		free(list[i]);
+	}
+	free(list);
+}
+
+/*
+ * Every JSON file with "oracles" in its name in the oracle directory is an
+ * oracle file.  Its tables are registered under a prefix derived from the
+ * file name, e.g. "settlement" for ironsworn_oracles_settlement.json.
+ */
+static void
+scan_oracle_sources(void)
+{
+	if ((sources = calloc(1, sizeof(*sources))) == NULL)
+		log_errx(1, "calloc");
+
+	if (override_dir != NULL)
+		scan_oracle_dir(override_dir);
+	scan_oracle_dir(oracle_dir);
+}
+
+/*
+ * Return the source for a file that showed up in one of the directories
+ * after the start, NULL if it is not an oracle file or already known.
+ */
+struct oracle_source *
+new_oracle_source(const char *dir, const char *file)
+{
+	struct dirent d;
+
+	if (sources == NULL)
+		scan_oracle_sources();
+
+	snprintf(d.d_name, sizeof(d.d_name), "%s", file);
+	if (!oracle_file_filter(&d))
+		return NULL;
+
+	return add_oracle_source(dir, file);
+}
+
+struct oracle_source *
+get_oracle_sources(size_t *n)
+{
+	if (sources == NULL)
+		scan_oracle_sources();
+
+	*n = nsources;
+	return sources;
+}
+
+/* Return the JSON file that provides the table with the given name */
+struct oracle_source *
+find_oracle_source(const char *name)
+{
+	size_t i, len;
+
+	if (sources == NULL)
+		scan_oracle_sources();
+
+	for (i = 0; i < nsources; i++) {
+		len = strlen(sources[i].prefix);
+		if (strncmp(name, sources[i].prefix, len) == 0 &&
+		    name[len] == '/')
+			return &sources[i];
+	}
+
+	return NULL;
+}
+
+const char *
+oracle_path(int what)
+{
+	if (what < 0 || what >= ORACLE_MAX)
+		return NULL;
+
+	return oracle_paths[what];
+}
+
+const char *
+get_oracle_dir()
+{
+	return oracle_dir;
+}
+
+void
+set_oracle_dir(const char *dir)
+{
+	oracle_dir = dir;
+}
+
+const char *
+get_oracle_override_dir()
+{
+	return override_dir;
+}
+
+/* Oracle files in this directory take precedence over the share dir */
+void
+set_oracle_override_dir(const char *dir)
+{
+	override_dir = dir;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2021 Matthias Schmidt <xhr@giessen.ccc.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reload oracle files that change while isscrolls is running.  The watch is
+ * checked in the main loop between two commands, so a roll always sees either
+ * the old or the new tables of a file, never a half loaded one.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isscrolls.h"
+
+static int watching = 0;
+
+/*
+ * Reload the oracle file dir/file.  A file in the override directory takes
+ * over from the file with the same name in the share directory.
+ */
+static void
+oracle_file_changed(const char *dir, const char *file)
+{
+	struct oracle_source *sources;
+	const char *override = get_oracle_override_dir();
+	size_t i, n;
+
+	sources = get_oracle_sources(&n);
+	for (i = 0; i < n; i++) {
+		if (strcmp(sources[i].file, file) != 0)
+			continue;
+		if (sources[i].dir != dir) {
+			if (dir != override)
+				return;
+			sources[i].dir = override;
+		}
+		log_debug("Oracle file %s/%s changed\n", dir, file);
+		reload_oracle_source(&sources[i]);
+		return;
+	}
+
+	/* New files are loaded on the first lookup of one of their tables */
+	new_oracle_source(dir, file);
+}
+
+#ifdef __linux__
+static int ifd = -1;
+static int wd_share = -1, wd_override = -1;
+
+void
+init_oracle_watch()
+{
+	const char *override = get_oracle_override_dir();
+
+	if ((ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		log_debug("inotify_init1: %s\n", strerror(errno));
+		return;
+	}
+
+	if ((wd_share = inotify_add_watch(ifd, get_oracle_dir(),
+	    IN_CLOSE_WRITE | IN_MOVED_TO)) == -1)
+		log_debug("Cannot watch %s\n", get_oracle_dir());
+	if (override != NULL && (wd_override = inotify_add_watch(ifd, override,
+	    IN_CLOSE_WRITE | IN_MOVED_TO)) == -1)
+		log_debug("Cannot watch %s\n", override);
+
+	watching = 1;
+}
+
+void
+check_oracle_watch()
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	const char *dir;
+	ssize_t len;
+	char *p;
+
+	if (!watching)
+		return;
+
+	while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->len == 0)
+				continue;
+			if (ev->wd == wd_override)
+				dir = get_oracle_override_dir();
+			else if (ev->wd == wd_share)
+				dir = get_oracle_dir();
+			else
+				continue;
+			oracle_file_changed(dir, ev->name);
+		}
+	}
+}
+#else
+/* Without inotify, compare the modification time of the loaded files */
+void
+init_oracle_watch()
+{
+	watching = 1;
+}
+
+void
+check_oracle_watch()
+{
+	char path[_POSIX_PATH_MAX];
+	struct oracle_source *sources;
+	struct stat sb;
+	size_t i, n;
+	int ret;
+
+	if (!watching)
+		return;
+
+	sources = get_oracle_sources(&n);
+	for (i = 0; i < n; i++) {
+		if (!sources[i].loaded)
+			continue;
+
+		ret = snprintf(path, sizeof(path), "%s/%s", sources[i].dir,
+			sources[i].file);
+		if (ret < 0 || (size_t)ret >= sizeof(path)) {
+			log_errx(1, "Path truncation happended.  Buffer to short to fit %s\n", path);
+		}
+
+		if (stat(path, &sb) == 0 && sb.st_mtime != sources[i].mtime) {
+			sources[i].mtime = sb.st_mtime;
+			oracle_file_changed(sources[i].dir, sources[i].file);
+		}
+	}
+}
+#endif /* __linux__ */